@@ -0,0 +1,167 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <cstdio>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Hardware counters for the calling thread, read through perf_event_open. Events the kernel or CPU does not support
+// (in a VM, or with perf_event_paranoid above 2) are left out, and report() then adds only the counters it has, or none.
+class PerfCounters
+{
+  public:
+    enum Event
+    {
+        Instructions,
+        CacheMisses,
+        BranchMisses,
+        TlbMisses,
+        EVENT_COUNT,
+    };
+
+    PerfCounters()
+    {
+#ifdef __linux__
+        static constexpr uint64_t CONFIGS[EVENT_COUNT][2] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        };
+
+        for (int event = 0; event < EVENT_COUNT; ++event)
+        {
+            perf_event_attr attr = {};
+            attr.size = sizeof(attr);
+            attr.type = CONFIGS[event][0];
+            attr.config = CONFIGS[event][1];
+            attr.disabled = leader < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            int fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+
+            if (fd < 0)
+            {
+                // without the first event there is no group to join
+                if (leader < 0 && event == Instructions)
+                {
+                    warn_unavailable();
+                    return;
+                }
+
+                continue;
+            }
+
+            leader = leader < 0 ? fd : leader;
+            fds[event] = fd;
+            group_index[event] = event_count++;
+        }
+#endif
+    }
+
+    ~PerfCounters()
+    {
+#ifdef __linux__
+        for (int fd : fds)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    bool is_available() const
+    {
+        return leader >= 0;
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        if (is_available())
+        {
+            ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+    }
+
+    void stop()
+    {
+#ifdef __linux__
+        if (!is_available())
+        {
+            return;
+        }
+
+        ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+        // nr, time enabled, time running, then one value per event in the order they joined the group
+        uint64_t values[3 + EVENT_COUNT] = {};
+        if (read(leader, values, sizeof(values)) < ssize_t(3 * sizeof(uint64_t)) || !values[2])
+        {
+            return;
+        }
+
+        // scale up if the kernel multiplexed the group with other events
+        double scale = double(values[1]) / values[2];
+
+        for (int event = 0; event < EVENT_COUNT; ++event)
+        {
+            if (fds[event] >= 0)
+            {
+                totals[event] = values[3 + group_index[event]] * scale;
+            }
+        }
+#endif
+    }
+
+    // adds <event>/op counters for the last start() to stop()
+    void report(benchmark::State &state, size_t ops) const
+    {
+        static constexpr const char *NAMES[EVENT_COUNT] = {"instructions/op", "cache_misses/op", "branch_misses/op",
+                                                           "dtlb_misses/op"};
+
+        for (int event = 0; event < EVENT_COUNT && ops; ++event)
+        {
+            if (fds[event] >= 0)
+            {
+                state.counters[NAMES[event]] = totals[event] / ops;
+            }
+        }
+    }
+
+  private:
+    static void warn_unavailable()
+    {
+        static bool warned = false;
+
+        if (!warned)
+        {
+            fprintf(stderr, "perf_event_open unavailable; hardware counters are not reported\n");
+            warned = true;
+        }
+    }
+
+    int leader = -1;
+    int fds[EVENT_COUNT] = {-1, -1, -1, -1};
+    int group_index[EVENT_COUNT] = {};
+    int event_count = 0;
+
+    double totals[EVENT_COUNT] = {};
+};
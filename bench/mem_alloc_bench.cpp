@@ -0,0 +1,636 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory_resource>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "memory_allocator/Adapter.h"
+#include "memory_allocator/BlockAllocator.h"
+#include "memory_allocator/LinearAllocator.h"
+#include "memory_allocator/MappedSegmentAllocator.h"
+#include "memory_allocator/PoolAllocator.h"
+
+#include "PerfCounters.h"
+
+constexpr size_t MB = 1024 * 1024;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Raw allocation workloads
+// ---------------------------------------------------------------------------------------------------------------------
+
+enum SizeDistribution
+{
+    // uniform 8..64 bytes
+    Small,
+    // log-uniform 8..4096 bytes
+    Mixed,
+    // uniform 4..64 KiB
+    Large,
+};
+
+static size_t get_max_size(SizeDistribution distribution)
+{
+    return distribution == Small ? 64 : distribution == Mixed ? 4096 : 64 * 1024;
+}
+
+struct Operation
+{
+    uint32_t slot;
+    uint32_t size;
+    bool allocate;
+};
+
+// A reproducible sequence of allocations and frees over live_set slots. While the live set is neither empty nor full,
+// alloc_percent of the operations allocate. The sequence ends by freeing everything still live.
+static std::vector<Operation> make_operations(SizeDistribution distribution, size_t live_set, int alloc_percent,
+                                              size_t count)
+{
+    std::mt19937 random(live_set * 100 + alloc_percent);
+    std::uniform_int_distribution<int> percent(0, 99);
+    std::uniform_int_distribution<uint32_t> small(8, 64), large(4 * 1024, 64 * 1024);
+    std::uniform_real_distribution<double> log_size(3, 12);
+
+    std::vector<uint32_t> free_slots, live_slots, sizes(live_set);
+    for (size_t i = live_set; i--;)
+    {
+        free_slots.push_back(i);
+    }
+
+    std::vector<Operation> operations;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        bool allocate = !live_slots.size() || (free_slots.size() && percent(random) < alloc_percent);
+
+        if (allocate)
+        {
+            uint32_t slot = free_slots.back();
+            free_slots.pop_back();
+            live_slots.push_back(slot);
+
+            sizes[slot] = distribution == Small   ? small(random)
+                          : distribution == Mixed ? uint32_t(std::exp2(log_size(random)))
+                                                  : large(random);
+
+            operations.push_back({slot, sizes[slot], true});
+        }
+        else
+        {
+            size_t live_index = std::uniform_int_distribution<size_t>(0, live_slots.size() - 1)(random);
+
+            uint32_t slot = live_slots[live_index];
+            live_slots[live_index] = live_slots.back();
+            live_slots.pop_back();
+            free_slots.push_back(slot);
+
+            operations.push_back({slot, sizes[slot], false});
+        }
+    }
+
+    for (uint32_t slot : live_slots)
+    {
+        operations.push_back({slot, sizes[slot], false});
+    }
+
+    return operations;
+}
+
+struct Malloc
+{
+    Malloc(size_t, size_t)
+    {
+    }
+
+    void *allocate(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void deallocate(void *mem, size_t)
+    {
+        free(mem);
+    }
+};
+
+struct PmrPool
+{
+    PmrPool(size_t, size_t)
+    {
+    }
+
+    void *allocate(size_t size)
+    {
+        return resource.allocate(size);
+    }
+
+    void deallocate(void *mem, size_t size)
+    {
+        resource.deallocate(mem, size);
+    }
+
+    std::pmr::unsynchronized_pool_resource resource;
+};
+
+template <typename BlockAllocatorType, bool Deferred = false> struct Block
+{
+    Block(size_t arena_size, size_t max_blocks) : allocator(arena_size, max_blocks)
+    {
+        if (Deferred)
+        {
+            allocator.set_coalesce_policy(BlockAllocatorType::CoalescePolicy::Deferred);
+        }
+    }
+
+    void *allocate(size_t size)
+    {
+        return allocator.allocate(size);
+    }
+
+    void deallocate(void *mem, size_t)
+    {
+        allocator.deallocate(mem);
+    }
+
+    BlockAllocatorType allocator;
+};
+
+struct MappedSegments
+{
+    MappedSegments(size_t arena_size, size_t)
+    {
+        allocator.add_chunk(arena_size);
+    }
+
+    void *allocate(size_t size)
+    {
+        return allocator.allocate<char>(size);
+    }
+
+    void deallocate(void *mem, size_t size)
+    {
+        allocator.deallocate(static_cast<char *>(mem), size);
+    }
+
+    MappedSegmentAllocator allocator;
+};
+
+// fixed-size blocks, so only registered for the Small distribution
+struct Pool
+{
+    Pool(size_t, size_t) : allocator(64, alignof(std::max_align_t), 256)
+    {
+    }
+
+    void *allocate(size_t)
+    {
+        return allocator.allocate();
+    }
+
+    void deallocate(void *mem, size_t)
+    {
+        allocator.deallocate(mem);
+    }
+
+    PoolAllocator allocator;
+};
+
+template <typename Resource> static void report_latency(benchmark::State &, const Resource &)
+{
+}
+
+#ifdef LATENCY_HISTOGRAMS
+static void report_latency(benchmark::State &state, const char *name, const LatencyHistogram &histogram)
+{
+    std::string prefix(name);
+
+    state.counters[prefix + "_p50"] = histogram.get_percentile(50);
+    state.counters[prefix + "_p99"] = histogram.get_percentile(99);
+    state.counters[prefix + "_p99.9"] = histogram.get_percentile(99.9);
+    state.counters[prefix + "_max"] = histogram.get_max();
+}
+
+// tail latencies in nanoseconds, which the mean time per loop hides
+template <typename BlockAllocatorType, bool Deferred>
+static void report_latency(benchmark::State &state, const Block<BlockAllocatorType, Deferred> &resource)
+{
+    report_latency(state, "alloc", resource.allocator.get_latency().allocate);
+    report_latency(state, "free", resource.allocator.get_latency().deallocate);
+}
+#endif
+
+template <typename Resource> static void BM_Churn(benchmark::State &state)
+{
+    SizeDistribution distribution = SizeDistribution(state.range(0));
+    size_t live_set = state.range(1);
+
+    std::vector<Operation> operations = make_operations(distribution, live_set, state.range(2), 4096);
+
+    // room for twice the worst-case live set, and a header per live block and per hole between them
+    Resource resource(live_set * get_max_size(distribution) * 2, live_set * 2 + 2);
+
+    std::vector<void *> slots(live_set);
+    size_t failed = 0;
+
+    PerfCounters counters;
+    counters.start();
+
+    for (auto _ : state)
+    {
+        for (const Operation &operation : operations)
+        {
+            if (operation.allocate)
+            {
+                void *mem = resource.allocate(operation.size);
+                benchmark::DoNotOptimize(mem);
+
+                failed += !mem;
+                slots[operation.slot] = mem;
+            }
+            else if (slots[operation.slot])
+            {
+                resource.deallocate(slots[operation.slot], operation.size);
+            }
+        }
+    }
+
+    counters.stop();
+
+    state.SetItemsProcessed(state.iterations() * operations.size());
+    counters.report(state, state.iterations() * operations.size());
+    state.counters["failed"] = benchmark::Counter(failed, benchmark::Counter::kAvgIterations);
+
+    report_latency(state, resource);
+}
+
+static void churn_arguments(benchmark::internal::Benchmark *benchmark)
+{
+    benchmark->ArgNames({"sizes", "live", "alloc%"})->ArgsProduct({{Small, Mixed, Large}, {64, 1024, 4096}, {50, 90}});
+}
+
+static void small_churn_arguments(benchmark::internal::Benchmark *benchmark)
+{
+    benchmark->ArgNames({"sizes", "live", "alloc%"})->ArgsProduct({{Small}, {64, 1024, 4096}, {50, 90}});
+}
+
+BENCHMARK_TEMPLATE(BM_Churn, Malloc)->Apply(churn_arguments);
+BENCHMARK_TEMPLATE(BM_Churn, PmrPool)->Apply(churn_arguments);
+BENCHMARK_TEMPLATE(BM_Churn, Block<BlockAllocator>)->Apply(churn_arguments);
+BENCHMARK_TEMPLATE(BM_Churn, Block<BlockAllocator, true>)->Apply(churn_arguments);
+BENCHMARK_TEMPLATE(BM_Churn, Block<CompactBlockAllocator>)->Apply(churn_arguments);
+BENCHMARK_TEMPLATE(BM_Churn, MappedSegments)->Apply(churn_arguments);
+BENCHMARK_TEMPLATE(BM_Churn, Pool)->Apply(small_churn_arguments);
+
+// Allocate a batch of small objects, then drop them all at once
+
+struct MallocBatch
+{
+    void *allocate(size_t size)
+    {
+        void *mem = malloc(size);
+        batch.push_back(mem);
+
+        return mem;
+    }
+
+    void release()
+    {
+        for (void *mem : batch)
+        {
+            free(mem);
+        }
+
+        batch.clear();
+    }
+
+    std::vector<void *> batch;
+};
+
+struct LinearBatch
+{
+    void *allocate(size_t size)
+    {
+        return allocator.allocate<char>((size + 15) & ~size_t(15));
+    }
+
+    void release()
+    {
+        allocator.free(first);
+    }
+
+    LinearAllocator allocator{16 * MB};
+    void *first = allocator.allocate<char>(0);
+};
+
+struct BlockBatch
+{
+    void *allocate(size_t size)
+    {
+        return allocator.allocate(size);
+    }
+
+    void release()
+    {
+        allocator.reset();
+    }
+
+    BlockAllocator allocator{16 * MB, 100'000};
+};
+
+struct PmrMonotonicBatch
+{
+    void *allocate(size_t size)
+    {
+        return resource.allocate(size);
+    }
+
+    void release()
+    {
+        resource.release();
+    }
+
+    std::pmr::monotonic_buffer_resource resource;
+};
+
+template <typename Batch> static void BM_Batch(benchmark::State &state)
+{
+    size_t count = state.range(0);
+
+    std::mt19937 random(count);
+    std::uniform_int_distribution<size_t> small(8, 64);
+
+    std::vector<size_t> sizes;
+    for (size_t i = 0; i < count; ++i)
+    {
+        sizes.push_back(small(random));
+    }
+
+    Batch batch;
+
+    PerfCounters counters;
+    counters.start();
+
+    for (auto _ : state)
+    {
+        for (size_t size : sizes)
+        {
+            benchmark::DoNotOptimize(batch.allocate(size));
+        }
+
+        batch.release();
+    }
+
+    counters.stop();
+
+    state.SetItemsProcessed(state.iterations() * count);
+    counters.report(state, state.iterations() * count);
+}
+
+BENCHMARK_TEMPLATE(BM_Batch, MallocBatch)->Arg(1024)->Arg(16 * 1024);
+BENCHMARK_TEMPLATE(BM_Batch, LinearBatch)->Arg(1024)->Arg(16 * 1024);
+BENCHMARK_TEMPLATE(BM_Batch, BlockBatch)->Arg(1024)->Arg(16 * 1024);
+BENCHMARK_TEMPLATE(BM_Batch, PmrMonotonicBatch)->Arg(1024)->Arg(16 * 1024);
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Container workloads
+// ---------------------------------------------------------------------------------------------------------------------
+
+struct StdPolicy
+{
+    template <typename T> using Allocator = std::allocator<T>;
+
+    static void init(size_t, size_t)
+    {
+    }
+
+    template <typename Container> static Container make()
+    {
+        return Container();
+    }
+};
+
+// GroupAllocatorType is the allocator behind the adapter's group; for PoolAllocator it serves array allocations
+template <typename AllocatorType, unsigned ID, typename GroupAllocatorType = AllocatorType> struct AdapterPolicy
+{
+    template <typename T> using Allocator = Adapter<T, AllocatorType, ID>;
+
+    static void init(size_t arena_size, size_t max_blocks)
+    {
+        AllocatorGroup<GroupAllocatorType, ID>::allocator.init(arena_size, max_blocks);
+    }
+
+    template <typename Container> static Container make()
+    {
+        return Container();
+    }
+};
+
+template <unsigned ID> struct DeferredAdapterPolicy : AdapterPolicy<BlockAllocator, ID>
+{
+    static void init(size_t arena_size, size_t max_blocks)
+    {
+        AllocatorGroup<BlockAllocator, ID>::allocator.init(arena_size, max_blocks);
+        AllocatorGroup<BlockAllocator, ID>::allocator.set_coalesce_policy(BlockAllocator::CoalescePolicy::Deferred);
+    }
+};
+
+struct PmrPoolPolicy
+{
+    template <typename T> using Allocator = std::pmr::polymorphic_allocator<T>;
+
+    static void init(size_t, size_t)
+    {
+    }
+
+    template <typename Container> static Container make()
+    {
+        static std::pmr::unsynchronized_pool_resource resource;
+
+        return Container(typename Container::allocator_type(&resource));
+    }
+};
+
+using BlockPolicy = AdapterPolicy<BlockAllocator, 1>;
+using DeferredBlockPolicy = DeferredAdapterPolicy<2>;
+using CompactBlockPolicy = AdapterPolicy<CompactBlockAllocator, 3>;
+using NodePoolPolicy = AdapterPolicy<PoolAllocator, 4, BlockAllocator>;
+
+// create, push one element, destroy
+template <typename Policy> static void BM_SmallVector(benchmark::State &state)
+{
+    using Vector = std::vector<int, typename Policy::template Allocator<int>>;
+
+    Policy::init(MB, 50);
+
+    int i = 0;
+
+    PerfCounters counters;
+    counters.start();
+
+    for (auto _ : state)
+    {
+        Vector v = Policy::template make<Vector>();
+        v.push_back(++i);
+        benchmark::DoNotOptimize(v.data());
+    }
+
+    counters.stop();
+
+    state.SetItemsProcessed(state.iterations());
+    counters.report(state, state.iterations());
+}
+
+BENCHMARK_TEMPLATE(BM_SmallVector, StdPolicy);
+BENCHMARK_TEMPLATE(BM_SmallVector, PmrPoolPolicy);
+BENCHMARK_TEMPLATE(BM_SmallVector, BlockPolicy);
+BENCHMARK_TEMPLATE(BM_SmallVector, CompactBlockPolicy);
+
+// grow a vector one element at a time
+template <typename Policy> static void BM_VectorGrowth(benchmark::State &state)
+{
+    using Vector = std::vector<int, typename Policy::template Allocator<int>>;
+
+    int count = state.range(0);
+    Policy::init(count * sizeof(int) * 4, 50);
+
+    PerfCounters counters;
+    counters.start();
+
+    for (auto _ : state)
+    {
+        Vector v = Policy::template make<Vector>();
+
+        for (int i = 0; i < count; ++i)
+        {
+            v.push_back(i);
+        }
+
+        benchmark::DoNotOptimize(v.data());
+    }
+
+    counters.stop();
+
+    state.SetItemsProcessed(state.iterations() * count);
+    counters.report(state, state.iterations() * count);
+}
+
+BENCHMARK_TEMPLATE(BM_VectorGrowth, StdPolicy)->Arg(1000)->Arg(100'000);
+BENCHMARK_TEMPLATE(BM_VectorGrowth, PmrPoolPolicy)->Arg(1000)->Arg(100'000);
+BENCHMARK_TEMPLATE(BM_VectorGrowth, BlockPolicy)->Arg(1000)->Arg(100'000);
+BENCHMARK_TEMPLATE(BM_VectorGrowth, CompactBlockPolicy)->Arg(1000)->Arg(100'000);
+
+// the RepeatedAllocationDeallocation pattern: build and drop a vector of vectors
+template <typename Policy> static void BM_NestedVectorChurn(benchmark::State &state)
+{
+    using Inner = std::vector<int, typename Policy::template Allocator<int>>;
+    using Outer = std::vector<Inner, typename Policy::template Allocator<Inner>>;
+
+    Policy::init(MB, 1000);
+
+    PerfCounters counters;
+    counters.start();
+
+    for (auto _ : state)
+    {
+        Outer vectors = Policy::template make<Outer>();
+
+        for (int i = 0; i < 20; ++i)
+        {
+            vectors.push_back(Policy::template make<Inner>());
+
+            for (int j = 0; j < 20; ++j)
+            {
+                vectors.back().push_back(j);
+            }
+        }
+
+        benchmark::DoNotOptimize(vectors.data());
+    }
+
+    counters.stop();
+
+    state.SetItemsProcessed(state.iterations() * 20 * 20);
+    counters.report(state, state.iterations() * 20 * 20);
+}
+
+BENCHMARK_TEMPLATE(BM_NestedVectorChurn, StdPolicy);
+BENCHMARK_TEMPLATE(BM_NestedVectorChurn, PmrPoolPolicy);
+BENCHMARK_TEMPLATE(BM_NestedVectorChurn, BlockPolicy);
+BENCHMARK_TEMPLATE(BM_NestedVectorChurn, DeferredBlockPolicy);
+BENCHMARK_TEMPLATE(BM_NestedVectorChurn, CompactBlockPolicy);
+
+// insert count keys, then erase them in a different order
+template <typename Policy, typename Map> static void run_map_insert_erase(benchmark::State &state)
+{
+    int count = state.range(0);
+
+    std::vector<int> keys(count);
+    for (int i = 0; i < count; ++i)
+    {
+        keys[i] = i;
+    }
+
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(count));
+
+    Policy::init(count * 256, count * 4);
+
+    PerfCounters counters;
+    counters.start();
+
+    for (auto _ : state)
+    {
+        Map map = Policy::template make<Map>();
+
+        for (int i = 0; i < count; ++i)
+        {
+            map.emplace(i, i);
+        }
+
+        for (int key : keys)
+        {
+            map.erase(key);
+        }
+
+        benchmark::DoNotOptimize(map.size());
+    }
+
+    counters.stop();
+
+    state.SetItemsProcessed(state.iterations() * count * 2);
+    counters.report(state, state.iterations() * count * 2);
+}
+
+template <typename Policy> static void BM_MapInsertErase(benchmark::State &state)
+{
+    using Map = std::map<int, int, std::less<int>, typename Policy::template Allocator<std::pair<const int, int>>>;
+
+    run_map_insert_erase<Policy, Map>(state);
+}
+
+template <typename Policy> static void BM_UnorderedMapInsertErase(benchmark::State &state)
+{
+    using Map = std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                                   typename Policy::template Allocator<std::pair<const int, int>>>;
+
+    run_map_insert_erase<Policy, Map>(state);
+}
+
+BENCHMARK_TEMPLATE(BM_MapInsertErase, StdPolicy)->Arg(1000)->Arg(10'000);
+BENCHMARK_TEMPLATE(BM_MapInsertErase, PmrPoolPolicy)->Arg(1000)->Arg(10'000);
+BENCHMARK_TEMPLATE(BM_MapInsertErase, BlockPolicy)->Arg(1000)->Arg(10'000);
+BENCHMARK_TEMPLATE(BM_MapInsertErase, CompactBlockPolicy)->Arg(1000)->Arg(10'000);
+BENCHMARK_TEMPLATE(BM_MapInsertErase, NodePoolPolicy)->Arg(1000)->Arg(10'000);
+
+BENCHMARK_TEMPLATE(BM_UnorderedMapInsertErase, StdPolicy)->Arg(1000)->Arg(10'000);
+BENCHMARK_TEMPLATE(BM_UnorderedMapInsertErase, PmrPoolPolicy)->Arg(1000)->Arg(10'000);
+BENCHMARK_TEMPLATE(BM_UnorderedMapInsertErase, BlockPolicy)->Arg(1000)->Arg(10'000);
+BENCHMARK_TEMPLATE(BM_UnorderedMapInsertErase, CompactBlockPolicy)->Arg(1000)->Arg(10'000);
+BENCHMARK_TEMPLATE(BM_UnorderedMapInsertErase, NodePoolPolicy)->Arg(1000)->Arg(10'000);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,176 @@
+#include <benchmark/benchmark.h>
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "memory_allocator/CoroutineFrame.h"
+
+// Coroutine creation rate: a request creates count coroutines, runs each to completion and destroys them, with frames
+// from the global operator new, the thread's CoroutineFramePool, or a LinearAllocator reset after each request.
+
+struct DefaultAllocation
+{
+};
+
+template <typename Allocation> class Task
+{
+  public:
+    struct promise_type : Allocation
+    {
+        int value = 0;
+
+        Task get_return_object()
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_always final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_value(int value)
+        {
+            promise_type::value = value;
+        }
+
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle)
+    {
+    }
+
+    Task(Task &&other) : handle(std::exchange(other.handle, {}))
+    {
+    }
+
+    ~Task()
+    {
+        if (handle)
+        {
+            handle.destroy();
+        }
+    }
+
+    int run()
+    {
+        handle.resume();
+
+        return handle.promise().value;
+    }
+
+  private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+// a frame of a few hundred bytes, like a handler keeping a small buffer across a suspension
+template <typename Allocation> static Task<Allocation> handle_request(int id)
+{
+    int buffer[64];
+    buffer[id % 64] = id;
+
+    co_await std::suspend_never();
+
+    co_return buffer[id % 64];
+}
+
+static Task<CoroutineFrameAllocation> handle_request(std::allocator_arg_t, LinearAllocator &, int id)
+{
+    int buffer[64];
+    buffer[id % 64] = id;
+
+    co_await std::suspend_never();
+
+    co_return buffer[id % 64];
+}
+
+struct HeapFrames
+{
+    using TaskType = Task<DefaultAllocation>;
+
+    TaskType create(int id)
+    {
+        return handle_request<DefaultAllocation>(id);
+    }
+
+    void end_request()
+    {
+    }
+};
+
+struct PoolFrames
+{
+    using TaskType = Task<CoroutineFrameAllocation>;
+
+    TaskType create(int id)
+    {
+        return handle_request<CoroutineFrameAllocation>(id);
+    }
+
+    void end_request()
+    {
+    }
+};
+
+struct ArenaFrames
+{
+    using TaskType = Task<CoroutineFrameAllocation>;
+
+    TaskType create(int id)
+    {
+        return handle_request(std::allocator_arg, arena, id);
+    }
+
+    void end_request()
+    {
+        arena.reset();
+    }
+
+    LinearAllocator arena{1024 * 1024};
+};
+
+template <typename Frames> static void BM_CoroutineRequest(benchmark::State &state)
+{
+    size_t count = state.range(0);
+
+    Frames frames;
+
+    std::vector<typename Frames::TaskType> tasks;
+    tasks.reserve(count);
+
+    for (auto _ : state)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            tasks.push_back(frames.create(int(i)));
+        }
+
+        for (auto &task : tasks)
+        {
+            benchmark::DoNotOptimize(task.run());
+        }
+
+        tasks.clear();
+        frames.end_request();
+    }
+
+    state.SetItemsProcessed(state.iterations() * count);
+}
+
+BENCHMARK_TEMPLATE(BM_CoroutineRequest, HeapFrames)->Arg(1)->Arg(64)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_CoroutineRequest, PoolFrames)->Arg(1)->Arg(64)->Arg(1024);
+BENCHMARK_TEMPLATE(BM_CoroutineRequest, ArenaFrames)->Arg(1)->Arg(64)->Arg(1024);
+
+BENCHMARK_MAIN();
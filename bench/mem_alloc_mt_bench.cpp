@@ -0,0 +1,549 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "memory_allocator/AsyncDeallocator.h"
+#include "memory_allocator/BlockAllocator.h"
+#include "memory_allocator/PoolAllocator.h"
+
+constexpr size_t MB = 1024 * 1024;
+
+constexpr size_t MAX_SIZE = 512;
+
+// slots per thread for independent churn, and per rack for Larson
+constexpr size_t LIVE_SET = 1024;
+
+// replacements each thread makes per benchmark iteration
+constexpr size_t OPS_PER_ITERATION = 256;
+
+// objects per producer/consumer hand-off, and how many hand-offs may be in flight per pair
+constexpr size_t BATCH_SIZE = 64;
+constexpr size_t QUEUE_DEPTH = 16;
+
+static int get_max_threads()
+{
+    unsigned threads = std::thread::hardware_concurrency();
+
+    return threads ? threads : 4;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Resources
+//
+// Every resource is shared by all benchmark threads, so it must be safe to call from any of them. The library's
+// allocators are single-threaded, so they run behind a mutex, except ThreadLocalBlock, which gives each thread its own
+// arena and so only serves workloads that free on the allocating thread, and RemoteFreeBlock.
+// ---------------------------------------------------------------------------------------------------------------------
+
+struct Malloc
+{
+    void *allocate(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void deallocate(void *mem, size_t)
+    {
+        free(mem);
+    }
+};
+
+struct PmrSynchronizedPool
+{
+    void *allocate(size_t size)
+    {
+        return resource.allocate(size);
+    }
+
+    void deallocate(void *mem, size_t size)
+    {
+        resource.deallocate(mem, size);
+    }
+
+    std::pmr::synchronized_pool_resource resource;
+};
+
+struct LockedBlock
+{
+    void *allocate(size_t size)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        return allocator.allocate(size);
+    }
+
+    void deallocate(void *mem, size_t)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        allocator.deallocate(mem);
+    }
+
+    std::mutex mutex;
+
+    // room for two Larson racks per thread at the largest size
+    BlockAllocator allocator{get_max_threads() * LIVE_SET * MAX_SIZE * 2 + MB, get_max_threads() * LIVE_SET * 4 + 2};
+};
+
+// LockedBlock with frees handed to a worker thread in batches
+struct AsyncLockedBlock
+{
+    void *allocate(size_t size)
+    {
+        return block.allocate(size);
+    }
+
+    void deallocate(void *mem, size_t)
+    {
+        deallocator.deallocate(mem);
+    }
+
+    LockedBlock block;
+
+    AsyncDeallocator deallocator{[this](void *const *mem, size_t count) {
+        std::lock_guard<std::mutex> lock(block.mutex);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            block.allocator.deallocate(mem[i]);
+        }
+    }};
+};
+
+struct LockedPool
+{
+    void *allocate(size_t)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        return allocator.allocate();
+    }
+
+    void deallocate(void *mem, size_t)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        allocator.deallocate(mem);
+    }
+
+    std::mutex mutex;
+
+    PoolAllocator allocator{MAX_SIZE, alignof(std::max_align_t), 1024};
+};
+
+struct ThreadLocalBlock
+{
+    void *allocate(size_t size)
+    {
+        return get_allocator().allocate(size);
+    }
+
+    void deallocate(void *mem, size_t)
+    {
+        get_allocator().deallocate(mem);
+    }
+
+    static BlockAllocator &get_allocator()
+    {
+        thread_local BlockAllocator allocator(LIVE_SET * MAX_SIZE * 2, LIVE_SET * 2 + 2);
+
+        return allocator;
+    }
+};
+
+// Each allocating thread owns an arena; other threads' frees are queued on it without a lock (set_owner_thread)
+struct RemoteFreeBlock
+{
+    void *allocate(size_t size)
+    {
+        thread_local ArenaLease lease;
+
+        if (!lease.resource)
+        {
+            lease.index = claim_arena();
+            lease.resource = this;
+        }
+
+        return arenas[lease.index].allocate(size);
+    }
+
+    void deallocate(void *mem, size_t)
+    {
+        size_t count = arena_count.load(std::memory_order_acquire);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (arenas[i].owns(mem))
+            {
+                return arenas[i].deallocate(mem);
+            }
+        }
+    }
+
+    // gives the thread's arena back when it exits
+    struct ArenaLease
+    {
+        ~ArenaLease()
+        {
+            if (resource)
+            {
+                resource->in_use[index].store(false, std::memory_order_release);
+            }
+        }
+
+        RemoteFreeBlock *resource = 0;
+        size_t index = 0;
+    };
+
+    // Arenas outlive their threads, as other threads may still be freeing into them until the run ends. Benchmark
+    // threads are started anew for each run, so an arena whose thread has exited belongs to a run that is over, with
+    // every block freed or on the remote list, and is reset for the next thread.
+    size_t claim_arena()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        size_t count = arena_count.load(std::memory_order_relaxed);
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!in_use[i].load(std::memory_order_acquire))
+            {
+                in_use[i].store(true, std::memory_order_relaxed);
+
+                arenas[i].reset();
+                arenas[i].set_owner_thread();
+
+                return i;
+            }
+        }
+
+        if (count == MAX_ARENAS)
+        {
+            abort();
+        }
+
+        arenas[count].init(BATCH_SIZE * (QUEUE_DEPTH + 2) * MAX_SIZE, BATCH_SIZE * (QUEUE_DEPTH + 2) * 2 + 2);
+        arenas[count].set_owner_thread();
+        in_use[count].store(true, std::memory_order_relaxed);
+
+        arena_count.store(count + 1, std::memory_order_release);
+
+        return count;
+    }
+
+    // more than the threads of any one run
+    static constexpr size_t MAX_ARENAS = 256;
+
+    std::mutex mutex;
+    std::unique_ptr<BlockAllocator[]> arenas{new BlockAllocator[MAX_ARENAS]};
+    std::unique_ptr<std::atomic<bool>[]> in_use{new std::atomic<bool>[MAX_ARENAS]};
+    std::atomic<size_t> arena_count{0};
+};
+
+template <typename Resource> static Resource &get_resource()
+{
+    static Resource resource;
+
+    return resource;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Workloads
+// ---------------------------------------------------------------------------------------------------------------------
+
+struct Replacement
+{
+    uint32_t slot;
+    uint32_t size;
+};
+
+// log-uniform sizes in [8, MAX_SIZE], seeded per thread so every thread has its own reproducible sequence
+static std::vector<Replacement> make_replacements(size_t seed, size_t count)
+{
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<uint32_t> slot(0, LIVE_SET - 1);
+    std::uniform_real_distribution<double> log_size(3, std::log2(MAX_SIZE));
+
+    std::vector<Replacement> replacements(count);
+    for (Replacement &replacement : replacements)
+    {
+        replacement = {slot(random), uint32_t(std::exp2(log_size(random)))};
+    }
+
+    return replacements;
+}
+
+struct Rack
+{
+    void *slots[LIVE_SET];
+    uint32_t sizes[LIVE_SET];
+};
+
+template <typename Resource> static void fill_rack(Resource &resource, Rack &rack, size_t seed)
+{
+    std::vector<Replacement> replacements = make_replacements(seed, LIVE_SET);
+
+    for (size_t i = 0; i < LIVE_SET; ++i)
+    {
+        rack.sizes[i] = replacements[i].size;
+        rack.slots[i] = resource.allocate(rack.sizes[i]);
+    }
+}
+
+template <typename Resource> static void empty_rack(Resource &resource, Rack &rack)
+{
+    for (size_t i = 0; i < LIVE_SET; ++i)
+    {
+        if (rack.slots[i])
+        {
+            resource.deallocate(rack.slots[i], rack.sizes[i]);
+        }
+    }
+}
+
+// free a random slot and refill it with a new size
+template <typename Resource> static void replace(Resource &resource, Rack &rack, const Replacement &replacement)
+{
+    if (rack.slots[replacement.slot])
+    {
+        resource.deallocate(rack.slots[replacement.slot], rack.sizes[replacement.slot]);
+    }
+
+    void *mem = resource.allocate(replacement.size);
+    if (mem)
+    {
+        // touch the object, as a real caller would
+        *static_cast<char *>(mem) = 1;
+    }
+
+    rack.slots[replacement.slot] = mem;
+    rack.sizes[replacement.slot] = replacement.size;
+}
+
+// Google Benchmark reports aggregate throughput across threads; this adds each thread's own time per operation,
+// averaged over the threads.
+static void report(benchmark::State &state, std::chrono::steady_clock::time_point start, size_t ops_per_iteration)
+{
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    size_t ops = state.iterations() * ops_per_iteration;
+
+    state.SetItemsProcessed(ops);
+    state.counters["thread_ns/op"] =
+        benchmark::Counter(ops ? seconds * 1e9 / ops : 0, benchmark::Counter::kAvgThreads);
+}
+
+// every thread churns its own live set; nothing crosses threads
+template <typename Resource> static void BM_IndependentChurn(benchmark::State &state)
+{
+    Resource &resource = get_resource<Resource>();
+    std::vector<Replacement> replacements = make_replacements(state.thread_index() + 1, OPS_PER_ITERATION * 16);
+
+    std::unique_ptr<Rack> rack(new Rack());
+    fill_rack(resource, *rack, state.thread_index());
+
+    size_t next = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (auto _ : state)
+    {
+        for (size_t i = 0; i < OPS_PER_ITERATION; ++i)
+        {
+            replace(resource, *rack, replacements[next++ % replacements.size()]);
+        }
+    }
+
+    report(state, start, OPS_PER_ITERATION * 2);
+
+    empty_rack(resource, *rack);
+}
+
+struct Batch
+{
+    void *objects[BATCH_SIZE];
+    uint32_t sizes[BATCH_SIZE];
+};
+
+// a bounded queue of batches between one producer and one consumer
+struct Channel
+{
+    void push(const Batch &batch)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [this] { return batches.size() < QUEUE_DEPTH; });
+
+        batches.push_back(batch);
+        not_empty.notify_one();
+    }
+
+    Batch pop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [this] { return batches.size(); });
+
+        Batch batch = batches.front();
+        batches.pop_front();
+        not_full.notify_one();
+
+        return batch;
+    }
+
+    std::mutex mutex;
+    std::condition_variable not_empty, not_full;
+    std::deque<Batch> batches;
+};
+
+// Even threads allocate batches and hand them to the next thread, which frees them. Every thread runs the same number
+// of iterations, so each queue is empty when the run ends.
+template <typename Resource> static void BM_ProducerConsumer(benchmark::State &state)
+{
+    static std::vector<Channel> channels(std::max(get_max_threads(), 2) / 2);
+
+    Resource &resource = get_resource<Resource>();
+    Channel &channel = channels[state.thread_index() / 2];
+    bool producer = state.thread_index() % 2 == 0;
+
+    std::vector<Replacement> sizes = make_replacements(state.thread_index() + 1, BATCH_SIZE * 16);
+
+    size_t next = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (auto _ : state)
+    {
+        if (producer)
+        {
+            Batch batch;
+
+            for (size_t i = 0; i < BATCH_SIZE; ++i)
+            {
+                batch.sizes[i] = sizes[next++ % sizes.size()].size;
+                batch.objects[i] = resource.allocate(batch.sizes[i]);
+
+                if (batch.objects[i])
+                {
+                    *static_cast<char *>(batch.objects[i]) = 1;
+                }
+            }
+
+            channel.push(batch);
+        }
+        else
+        {
+            Batch batch = channel.pop();
+
+            for (size_t i = 0; i < BATCH_SIZE; ++i)
+            {
+                if (batch.objects[i])
+                {
+                    benchmark::DoNotOptimize(*static_cast<char *>(batch.objects[i]));
+                    resource.deallocate(batch.objects[i], batch.sizes[i]);
+                }
+            }
+        }
+    }
+
+    report(state, start, BATCH_SIZE);
+}
+
+// The Larson server pattern: each thread replaces random objects in a rack, then hands the rack to whichever thread
+// asks next and takes an older one, so most objects are freed by a thread other than the one that allocated them.
+template <typename Resource> static void BM_Larson(benchmark::State &state)
+{
+    static std::mutex mutex;
+    static std::deque<Rack *> racks;
+
+    Resource &resource = get_resource<Resource>();
+    std::vector<Replacement> replacements = make_replacements(state.thread_index() + 1, OPS_PER_ITERATION * 16);
+
+    // each thread brings one rack to work on and one to the exchange, and frees two when the run ends
+    Rack *rack = new Rack();
+    fill_rack(resource, *rack, state.thread_index() * 2);
+
+    {
+        Rack *exchanged = new Rack();
+        fill_rack(resource, *exchanged, state.thread_index() * 2 + 1);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        racks.push_back(exchanged);
+    }
+
+    size_t next = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (auto _ : state)
+    {
+        for (size_t i = 0; i < OPS_PER_ITERATION; ++i)
+        {
+            replace(resource, *rack, replacements[next++ % replacements.size()]);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        racks.push_back(rack);
+        rack = racks.front();
+        racks.pop_front();
+    }
+
+    report(state, start, OPS_PER_ITERATION * 2);
+
+    empty_rack(resource, *rack);
+    delete rack;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        rack = racks.front();
+        racks.pop_front();
+    }
+
+    empty_rack(resource, *rack);
+    delete rack;
+}
+
+static void thread_counts(benchmark::internal::Benchmark *benchmark)
+{
+    benchmark->ThreadRange(1, get_max_threads())->UseRealTime();
+}
+
+// producer/consumer needs whole pairs
+static void pair_thread_counts(benchmark::internal::Benchmark *benchmark)
+{
+    for (int threads = 2; threads <= std::max(get_max_threads(), 2); threads *= 2)
+    {
+        benchmark->Threads(threads);
+    }
+
+    benchmark->UseRealTime();
+}
+
+BENCHMARK_TEMPLATE(BM_IndependentChurn, Malloc)->Apply(thread_counts);
+BENCHMARK_TEMPLATE(BM_IndependentChurn, PmrSynchronizedPool)->Apply(thread_counts);
+BENCHMARK_TEMPLATE(BM_IndependentChurn, LockedBlock)->Apply(thread_counts);
+BENCHMARK_TEMPLATE(BM_IndependentChurn, LockedPool)->Apply(thread_counts);
+BENCHMARK_TEMPLATE(BM_IndependentChurn, ThreadLocalBlock)->Apply(thread_counts);
+
+BENCHMARK_TEMPLATE(BM_ProducerConsumer, Malloc)->Apply(pair_thread_counts);
+BENCHMARK_TEMPLATE(BM_ProducerConsumer, PmrSynchronizedPool)->Apply(pair_thread_counts);
+BENCHMARK_TEMPLATE(BM_ProducerConsumer, LockedBlock)->Apply(pair_thread_counts);
+BENCHMARK_TEMPLATE(BM_ProducerConsumer, LockedPool)->Apply(pair_thread_counts);
+BENCHMARK_TEMPLATE(BM_ProducerConsumer, RemoteFreeBlock)->Apply(pair_thread_counts);
+BENCHMARK_TEMPLATE(BM_ProducerConsumer, AsyncLockedBlock)->Apply(pair_thread_counts);
+
+BENCHMARK_TEMPLATE(BM_Larson, Malloc)->Apply(thread_counts);
+BENCHMARK_TEMPLATE(BM_Larson, PmrSynchronizedPool)->Apply(thread_counts);
+BENCHMARK_TEMPLATE(BM_Larson, LockedBlock)->Apply(thread_counts);
+BENCHMARK_TEMPLATE(BM_Larson, LockedPool)->Apply(thread_counts);
+BENCHMARK_TEMPLATE(BM_Larson, AsyncLockedBlock)->Apply(thread_counts);
+
+BENCHMARK_MAIN();
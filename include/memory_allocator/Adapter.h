@@ -1,19 +1,46 @@
 #pragma once
 
 #include <cstddef>
+#include <memory>
 #include <new>
 #include <type_traits>
 
 #include "memory_allocator/BlockAllocator.h"
+#include "memory_allocator/InlineArena.h"
+#include "memory_allocator/OffsetPtr.h"
+#include "memory_allocator/PoolAllocator.h"
+#include "memory_allocator/SharedBlockAllocator.h"
 
 template <typename T> struct is_allocator : std::false_type
 {
 };
 
-template <> struct is_allocator<BlockAllocator> : std::true_type
+template <typename Word, size_t MinAlignment>
+struct is_allocator<BasicBlockAllocator<Word, MinAlignment>> : std::true_type
 {
 };
 
+template <> struct is_allocator<SharedBlockAllocator> : std::true_type
+{
+};
+
+template <size_t MemorySize, size_t MaxBlockCount, typename Allocator>
+struct is_allocator<InlineArena<MemorySize, MaxBlockCount, Allocator>> : std::true_type
+{
+};
+
+// The pointer type containers store for memory from AllocatorType. Memory shared between processes is mapped at
+// different addresses, so it holds offsets.
+template <typename AllocatorType, typename T> struct allocator_pointer
+{
+    using type = T *;
+};
+
+template <typename T> struct allocator_pointer<SharedBlockAllocator, T>
+{
+    using type = OffsetPtr<T>;
+};
+
 template <typename T> using ValidAllocator = typename std::enable_if<is_allocator<T>::value>::type;
 
 template <typename ValueType, typename AllocatorType, unsigned ID = 0, typename Enable = void> class Adapter
@@ -25,6 +52,7 @@ class Adapter<ValueType, AllocatorType, ID, ValidAllocator<AllocatorType>>
 {
   public:
     using value_type = ValueType;
+    using pointer = typename allocator_pointer<AllocatorType, ValueType>::type;
 
     Adapter() = default;
 
@@ -60,7 +88,7 @@ class Adapter<ValueType, AllocatorType, ID, ValidAllocator<AllocatorType>>
         return *this;
     }
 
-    static ValueType *allocate(size_t n = 1)
+    static pointer allocate(size_t n = 1)
     {
         ValueType *mem = static_cast<ValueType *>(allocator.allocate(n * sizeof(ValueType), alignof(ValueType)));
 
@@ -69,12 +97,12 @@ class Adapter<ValueType, AllocatorType, ID, ValidAllocator<AllocatorType>>
             throw std::bad_alloc();
         }
 
-        return mem;
+        return pointer(mem);
     }
 
-    static void deallocate(ValueType *mem, size_t n)
+    static void deallocate(pointer mem, size_t n)
     {
-        return allocator.deallocate(mem);
+        return allocator.deallocate(std::addressof(*mem));
     }
 
     template <typename V, typename A, unsigned I> bool operator==(const Adapter<V, A, I> &other)
@@ -89,16 +117,32 @@ class Adapter<ValueType, AllocatorType, ID, ValidAllocator<AllocatorType>>
 
     static AllocatorType &allocator;
 
-    template <typename... Args> static ValueType *emplace(Args &&...args)
+    // Traces every allocation made through adapters sharing this allocator
+    static void set_trace(AllocationTrace *trace)
     {
-        ValueType *mem = allocate();
+        allocator.set_trace(trace);
+    }
 
-        new (mem) ValueType(args...);
+    static void set_sampler(AllocationSampler *sampler)
+    {
+        allocator.set_sampler(sampler);
+    }
+
+    static void set_budget(MemoryBudget *budget)
+    {
+        allocator.set_budget(budget);
+    }
+
+    template <typename... Args> static pointer emplace(Args &&...args)
+    {
+        pointer mem = allocate();
+
+        new (std::addressof(*mem)) ValueType(args...);
 
         return mem;
     }
 
-    static void remove(ValueType *value)
+    static void remove(pointer value)
     {
         value->~ValueType();
 
@@ -117,3 +161,121 @@ template <typename AllocatorType, unsigned ID> AllocatorType AllocatorGroup<Allo
 template <typename ValueType, typename AllocatorType, unsigned ID>
 AllocatorType &Adapter<ValueType, AllocatorType, ID, ValidAllocator<AllocatorType>>::allocator =
     AllocatorGroup<AllocatorType, ID>::allocator;
+
+template <size_t Size, size_t Alignment, unsigned ID> class PoolGroup
+{
+  public:
+    static PoolAllocator allocator;
+};
+
+template <size_t Size, size_t Alignment, unsigned ID>
+PoolAllocator PoolGroup<Size, Alignment, ID>::allocator(Size, Alignment);
+
+// Node-based containers allocate their nodes one at a time, so single-object requests are served from a fixed-size
+// pool shared by every value type of the same size and alignment. Array requests (e.g. unordered_map buckets) fall
+// back to the BlockAllocator of the same group ID.
+template <typename ValueType, unsigned ID> class Adapter<ValueType, PoolAllocator, ID>
+{
+  public:
+    using value_type = ValueType;
+
+    Adapter() = default;
+
+    Adapter(const Adapter &other)
+    {
+    }
+
+    template <typename V, typename A, unsigned I> Adapter(const Adapter<V, A, I> &other)
+    {
+    }
+
+    Adapter &operator=(const Adapter &other)
+    {
+        return *this;
+    }
+
+    template <typename V, typename A, unsigned I> Adapter &operator=(const Adapter<V, A, I> &other)
+    {
+        return *this;
+    }
+
+    template <typename V> struct rebind
+    {
+        using other = Adapter<V, PoolAllocator, ID>;
+    };
+
+    Adapter(Adapter &&other)
+    {
+    }
+
+    Adapter &operator=(Adapter &&other)
+    {
+        return *this;
+    }
+
+    static ValueType *allocate(size_t n = 1)
+    {
+        void *mem = n == 1 ? allocator.allocate() : fallback.allocate(n * sizeof(ValueType), alignof(ValueType));
+
+        if (!mem)
+        {
+            throw std::bad_alloc();
+        }
+
+        return static_cast<ValueType *>(mem);
+    }
+
+    static void deallocate(ValueType *mem, size_t n)
+    {
+        if (n == 1)
+        {
+            return allocator.deallocate(mem);
+        }
+
+        return fallback.deallocate(mem);
+    }
+
+    template <typename V, typename A, unsigned I> bool operator==(const Adapter<V, A, I> &other)
+    {
+        return &fallback == &other.fallback;
+    }
+
+    template <typename V, typename A, unsigned I> bool operator!=(const Adapter<V, A, I> &other)
+    {
+        return !(*this == other);
+    }
+
+    static PoolAllocator &allocator;
+
+    static BlockAllocator &fallback;
+
+    // Traces this value type's pool and the array fallback
+    static void set_trace(AllocationTrace *trace)
+    {
+        allocator.set_trace(trace);
+        fallback.set_trace(trace);
+    }
+
+    template <typename... Args> static ValueType *emplace(Args &&...args)
+    {
+        ValueType *mem = allocate();
+
+        new (mem) ValueType(args...);
+
+        return mem;
+    }
+
+    static void remove(ValueType *value)
+    {
+        value->~ValueType();
+
+        deallocate(value, 1);
+    }
+};
+
+template <typename ValueType, unsigned ID>
+PoolAllocator &Adapter<ValueType, PoolAllocator, ID>::allocator =
+    PoolGroup<sizeof(ValueType), alignof(ValueType), ID>::allocator;
+
+template <typename ValueType, unsigned ID>
+BlockAllocator &Adapter<ValueType, PoolAllocator, ID>::fallback = AllocatorGroup<BlockAllocator, ID>::allocator;
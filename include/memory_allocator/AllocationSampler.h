@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+// Samples about one allocation per sampling_interval bytes and keeps the call stack of each sampled allocation that is
+// still live. Intervals between samples are drawn from an exponential distribution, so every byte is equally likely to
+// be sampled however allocation sizes line up with the interval.
+//
+// Like the allocators, a sampler is not thread-safe: give each allocator its own, or synchronize externally.
+class AllocationSampler
+{
+  public:
+    explicit AllocationSampler(size_t sampling_interval = 512 * 1024, uint64_t seed = 1);
+
+    void record_allocate(const void *mem, size_t size)
+    {
+        bytes_until_sample -= int64_t(size);
+
+        if (bytes_until_sample < 0)
+        {
+            sample(mem, size);
+        }
+    }
+
+    void record_deallocate(const void *mem)
+    {
+        if (live.size())
+        {
+            forget(mem);
+        }
+    }
+
+    // live sampled allocations
+    size_t get_sample_count() const;
+
+    // Writes the sampled live set as a gperftools heap profile (heap_v2), which pprof reads and scales up by the
+    // sampling interval. Returns false if the file cannot be written.
+    bool write_heap_profile(const char *path) const;
+
+  private:
+    static constexpr int MAX_FRAMES = 64;
+
+    struct Sample
+    {
+        size_t size;
+        size_t stack;
+    };
+
+    struct Totals
+    {
+        size_t live_count = 0, live_bytes = 0;
+        size_t total_count = 0, total_bytes = 0;
+    };
+
+    void sample(const void *mem, size_t size);
+
+    void forget(const void *mem);
+
+    int64_t get_next_interval();
+
+    size_t sampling_interval;
+    int64_t bytes_until_sample;
+
+    std::mt19937_64 random;
+
+    std::unordered_map<uintptr_t, Sample> live;
+
+    std::map<std::vector<void *>, size_t> stack_ids;
+    std::vector<const std::vector<void *> *> stacks;
+    std::vector<Totals> totals;
+};
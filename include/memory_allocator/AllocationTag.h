@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Identifies the subsystem that owns an allocation. 0 is untagged.
+using AllocationTag = uint8_t;
+
+constexpr size_t ALLOCATION_TAG_COUNT = 256;
+
+// Tags every allocation made on this thread while the scope is alive. Scopes nest; the innermost tag wins.
+class AllocationTagScope
+{
+  public:
+    explicit AllocationTagScope(AllocationTag tag) : previous(current)
+    {
+        current = tag;
+    }
+
+    ~AllocationTagScope()
+    {
+        current = previous;
+    }
+
+    AllocationTagScope(const AllocationTagScope &) = delete;
+    AllocationTagScope &operator=(const AllocationTagScope &) = delete;
+
+    static AllocationTag get_current()
+    {
+        return current;
+    }
+
+  private:
+    static inline thread_local AllocationTag current = 0;
+
+    AllocationTag previous;
+};
+
+// Live bytes and allocations per tag
+class TagCounters
+{
+  public:
+    void add(AllocationTag tag, size_t size)
+    {
+        live_bytes[tag] += size;
+        ++live_counts[tag];
+    }
+
+    void remove(AllocationTag tag, size_t size)
+    {
+        live_bytes[tag] -= size;
+        --live_counts[tag];
+    }
+
+    size_t get_live_bytes(AllocationTag tag) const
+    {
+        return live_bytes[tag];
+    }
+
+    size_t get_live_count(AllocationTag tag) const
+    {
+        return live_counts[tag];
+    }
+
+    void clear()
+    {
+        *this = TagCounters();
+    }
+
+  private:
+    size_t live_bytes[ALLOCATION_TAG_COUNT] = {};
+    size_t live_counts[ALLOCATION_TAG_COUNT] = {};
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+// Records allocate and free events to a binary file: an 8 byte magic ("MATRACE1") and a 4 byte little-endian event
+// size, followed by packed Events in the order they were recorded.
+class AllocationTrace
+{
+  public:
+    enum class Operation : uint8_t
+    {
+        Allocate,
+        Deallocate,
+    };
+
+    struct Event
+    {
+        // nanoseconds since the trace was opened
+        uint64_t timestamp;
+        // 0 for a failed allocation
+        uint64_t address;
+        // requested bytes, saturated at 4 GiB; 0 for frees
+        uint32_t size;
+        uint8_t alignment_log2;
+        Operation operation;
+        // small per-thread index, in order of each thread's first event
+        uint16_t thread;
+    };
+
+    static_assert(sizeof(Event) == 24, "trace events are expected to be packed");
+
+    AllocationTrace() = default;
+    ~AllocationTrace();
+
+    bool open(const char *path);
+
+    void close();
+
+    void record_allocate(const void *mem, size_t size, size_t alignment);
+
+    void record_deallocate(const void *mem);
+
+    static bool read(const char *path, std::vector<Event> &events);
+
+  private:
+    static constexpr size_t BUFFER_SIZE = 1024;
+
+    void record(const void *mem, size_t size, size_t alignment, Operation operation);
+
+    void flush();
+
+    FILE *file = 0;
+
+    std::mutex mutex;
+
+    std::chrono::steady_clock::time_point start;
+
+    Event buffer[BUFFER_SIZE];
+    size_t buffered = 0;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+
+// A snapshot of an allocator's occupancy. Allocators keep these counters up to date as they go, so taking a
+// snapshot does not walk the arena.
+struct AllocatorStats
+{
+    // bytes the allocator can hand out without asking the system for more
+    size_t capacity = 0;
+
+    size_t bytes_in_use = 0;
+    size_t free_bytes = 0;
+
+    // the largest single request that can be served right now
+    size_t largest_free_block = 0;
+
+    // the most bytes in use at once since init
+    size_t high_water_mark = 0;
+
+    // bytes of memory mappings held by allocations too large for the arena; not part of the figures above
+    size_t mapped_bytes = 0;
+
+    // block headers in use, out of max_block_count; both 0 for allocators without headers
+    size_t headers_used = 0;
+    size_t header_capacity = 0;
+
+    // External fragmentation: 1 - largest_free_block / free_bytes, the share of free memory that is not in the largest
+    // free block. 0 when nothing is free, and always 0 for PoolAllocator, whose free blocks all fit its one size.
+    double fragmentation = 0;
+};
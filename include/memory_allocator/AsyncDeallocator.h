@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Moves frees off latency-critical threads. deallocate() appends the pointer to a buffer owned by the calling thread;
+// each full buffer is queued for a worker thread, which hands it to free_batch. The queue is bounded: a thread that
+// fills a buffer while max_queued_batches are waiting blocks until the worker catches up. A thread keeps a buffer for
+// each of up to THREAD_BUFFERS deallocators it frees through; freeing through another queues one of those buffers.
+//
+// free_batch runs on the worker, so it must take whatever lock the allocator's other users take, e.g.
+//
+//     AsyncDeallocator deallocator([&](void *const *mem, size_t count) {
+//         std::lock_guard<std::mutex> lock(mutex);
+//         for (size_t i = 0; i < count; ++i)
+//             allocator.deallocate(mem[i]);
+//     });
+//
+// Threads must stop calling deallocate before the AsyncDeallocator is destroyed; everything they queued is freed then.
+class AsyncDeallocator
+{
+  public:
+    static constexpr size_t BATCH_SIZE = 256;
+
+    static constexpr size_t THREAD_BUFFERS = 4;
+
+    using FreeBatch = std::function<void(void *const *mem, size_t count)>;
+
+    explicit AsyncDeallocator(FreeBatch free_batch, size_t max_queued_batches = 16);
+    ~AsyncDeallocator();
+
+    AsyncDeallocator(const AsyncDeallocator &) = delete;
+    AsyncDeallocator &operator=(const AsyncDeallocator &) = delete;
+
+    void deallocate(void *mem)
+    {
+        ThreadBuffer *buffer = thread_buffers.current;
+
+        if (buffer && buffer->owner.load(std::memory_order_relaxed) == this)
+        {
+            Batch *batch = buffer->batch;
+            batch->mem[batch->count++] = mem;
+
+            if (batch->count == BATCH_SIZE)
+            {
+                submit(*buffer);
+            }
+
+            return;
+        }
+
+        switch_buffer(mem);
+    }
+
+    // Queues this thread's partial buffer and waits until everything queued so far has been freed
+    void flush();
+
+  private:
+    struct Batch
+    {
+        void *mem[BATCH_SIZE];
+        size_t count = 0;
+    };
+
+    struct ThreadBuffer
+    {
+        ~ThreadBuffer();
+
+        // Cleared by whichever of the thread and the owner's destructor claims the buffer first; the thread then
+        // detaches it, and the destructor waits for that
+        std::atomic<AsyncDeallocator *> owner{0};
+        Batch *batch = 0;
+    };
+
+    struct ThreadBuffers
+    {
+        ThreadBuffer buffers[THREAD_BUFFERS];
+
+        // the buffer deallocate tries first
+        ThreadBuffer *current = 0;
+
+        // taken over when every buffer has an owner
+        size_t next_evicted = 0;
+    };
+
+    // a thread's buffers, each for the AsyncDeallocator it is attached to, or none
+    static thread_local ThreadBuffers thread_buffers;
+
+    // finds or attaches this thread's buffer for this deallocator, and appends mem to it
+    void switch_buffer(void *mem);
+
+    // on the buffer's thread; claims it from its owner, if the owner's destructor has not, and detaches it
+    static void release(ThreadBuffer &buffer);
+
+    void detach(ThreadBuffer &buffer);
+
+    void submit(ThreadBuffer &buffer);
+
+    // waits, with the lock held, until the queue has room
+    void enqueue(std::unique_lock<std::mutex> &lock, Batch *batch);
+
+    Batch *take_spare();
+
+    void run();
+
+    FreeBatch free_batch;
+    size_t max_queued_batches;
+
+    std::mutex mutex;
+    std::condition_variable not_empty, progress;
+
+    std::deque<Batch *> queue;
+    std::vector<Batch *> spares;
+    std::vector<ThreadBuffer *> buffers;
+
+    bool busy = false;
+    bool stopping = false;
+
+    std::thread worker;
+};
@@ -1,44 +1,156 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <thread>
+#include <vector>
 
-class BlockAllocator
+#include "memory_allocator/AllocationTag.h"
+#include "memory_allocator/AllocatorStats.h"
+
+#ifdef LATENCY_HISTOGRAMS
+#include "memory_allocator/LatencyHistogram.h"
+#endif
+
+class AllocationSampler;
+class AllocationTrace;
+class MemoryBudget;
+
+// Word is the type of one header entry, and block sizes are stored in units of MinAlignment bytes. With a 32-bit
+// Word an arena can hold up to 4 GiB of MinAlignment units, and twice as many headers fit in a cache line.
+template <typename Word = uint64_t, size_t MinAlignment = 1> class BasicBlockAllocator
 {
-    struct Header
+    static_assert(!(MinAlignment & (MinAlignment - 1)), "MinAlignment must be a power of two");
+    static_assert(MinAlignment <= alignof(std::max_align_t), "MinAlignment cannot exceed the alignment of malloc");
+
+    static constexpr size_t INVALID_INT = ~size_t(0);
+
+    // Sits just before the first byte of a mapped allocation, and links it into the list of mapped regions
+    struct LargeRegion
     {
-      public:
-        size_t get_size() const;
+        LargeRegion *previous;
+        LargeRegion *next;
+        char *base;
+        size_t mapped_size;
+        size_t size;
+        AllocationTag tag;
+    };
 
-        bool is_free() const;
+  public:
+    enum class CoalescePolicy
+    {
+        // merge with free neighbours on every deallocate
+        Immediate,
+        // leave freed blocks split; merge only when an allocation finds no fit, or on coalesce()
+        Deferred,
+    };
 
-        void set_free(bool free);
+    BasicBlockAllocator() = default;
+    BasicBlockAllocator(size_t memory_size, size_t max_block_count);
+    void init(size_t memory_size, size_t max_block_count);
+
+    // Lays the arena and headers out in buffer, which must be aligned to max_align_t and hold at least
+    // get_buffer_size(memory_size, max_block_count) bytes: a stack or static array, a region mapped by the caller, or
+    // a block of another arena. The allocator does not free buffer.
+    BasicBlockAllocator(void *buffer, size_t memory_size, size_t max_block_count);
+    void init(void *buffer, size_t memory_size, size_t max_block_count);
+
+    static constexpr size_t get_buffer_size(size_t memory_size, size_t max_block_count)
+    {
+        // the arena, padded to the free bitmap, then the sizes and tags
+        return ((memory_size - memory_size % MinAlignment + alignof(uint64_t) - 1) & ~(alignof(uint64_t) - 1)) +
+               (max_block_count + 63) / 64 * sizeof(uint64_t) + max_block_count * (sizeof(Word) + sizeof(AllocationTag));
+    }
+
+    // Points the allocator at another view of the buffer it was initialized with, e.g. the same shared memory mapped at
+    // a different address, or a copy of the buffer
+    void rebase(void *buffer);
+
+    ~BasicBlockAllocator();
+
+    void *allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+    void deallocate(void *mem);
 
-        void reset();
+    // Resizes mem, keeping its contents up to the smaller of the two sizes. Mapped allocations grow and shrink in place
+    // or are moved by the kernel without a copy; others are copied to a new block. Returns 0, leaving mem untouched, if
+    // there is no room.
+    void *reallocate(void *mem, size_t size, size_t alignment = alignof(std::max_align_t));
 
-        void increment_size(size_t diff);
+    // Whether mem was allocated here, from the arena or a mapped region
+    bool owns(const void *mem) const;
 
-        bool is_empty();
+    // Requests of at least threshold bytes get their own memory mapping instead of a block of the arena, so large
+    // buffers do not fragment it; 0, the default, turns this off. Only available on Linux.
+    void set_large_allocation_threshold(size_t threshold);
 
-        Header &operator+=(Header &other);
+    void set_coalesce_policy(CoalescePolicy policy);
 
-      private:
-        static constexpr size_t size_mask = ~size_t(0) >> 1;
-        static constexpr size_t free_mask = ~size_mask;
+    // Merges runs of adjacent free blocks in a single pass, stopping after max_merges merges. Returns the number of
+    // merges performed.
+    size_t coalesce(size_t max_merges = INVALID_INT);
 
-        size_t size_and_free_flag = free_mask;
+    // Returns the pages of free ranges that were free, with the same bounds, at more than idle_passes consecutive calls
+    // to the OS with madvise, releasing at most max_bytes per call; returns the bytes released. The ranges stay mapped,
+    // so reusing them costs a page fault. Only available on Linux, for arenas the allocator allocated itself.
+    size_t release_idle_memory(size_t idle_passes, size_t max_bytes = INVALID_INT);
+
+    // Drops every allocation at once without calling destructors or touching the arena.
+    void reset();
+
+    // Incremented by every reset(). Raw pointers are not checked against it; see Handle.
+    size_t get_epoch() const;
+
+    // A block tagged with the epoch it was allocated in. Debug builds abort when a handle from before a reset() is
+    // used, even if a newer block now starts at the same address; release builds do not check.
+    struct Handle
+    {
+        void *mem;
+        size_t epoch;
     };
 
-  public:
-    BlockAllocator() = default;
-    BlockAllocator(size_t memory_size, size_t max_block_count);
-    void init(size_t memory_size, size_t max_block_count);
+    Handle allocate_handle(size_t size, size_t alignment = alignof(std::max_align_t));
 
-    ~BlockAllocator();
+    void deallocate(Handle handle);
 
-    void *allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+    // As reallocate(void *), tagged with the current epoch. If there is no room, mem is 0 and handle stays valid.
+    Handle reallocate(Handle handle, size_t size, size_t alignment = alignof(std::max_align_t));
 
-    void deallocate(void *mem);
+    void *get(Handle handle) const;
+
+    // Records every allocate and deallocate to trace; 0 stops tracing.
+    void set_trace(AllocationTrace *trace);
+
+    // Counts allocations against budget's limits: past the hard limit allocate returns 0. Set it before allocating;
+    // 0 removes it.
+    void set_budget(MemoryBudget *budget);
+
+    // Makes owner the only thread that allocates and frees directly. deallocate on any other thread pushes the block
+    // onto a lock-free list with a single CAS, and the owner frees the whole list on its next allocate, so frees from
+    // other threads never take a lock or touch the headers. No blocks may be in use when the owner is set; while one is
+    // set, blocks are at least pointer-sized, to hold the list links. std::thread::id() clears it.
+    void set_owner_thread(std::thread::id owner = std::this_thread::get_id());
+
+    // Reports allocations and frees to sampler, which keeps stacks for a sample of them; 0 stops sampling.
+    void set_sampler(AllocationSampler *sampler);
+
+    // O(1), with largest_free_block exact. Keeping it exact costs a rescan of the headers only when the largest free
+    // block is allocated from and what is left of it is not alone in the top power-of-two size class.
+    AllocatorStats get_stats() const;
+
+    // Live bytes and allocations per AllocationTag, as set by the AllocationTagScope active when each block was
+    // allocated
+    const TagCounters &get_tag_counters() const;
+
+    // Writes the block map to path in the HeapDump format. Returns false if the file cannot be written.
+    bool dump(const char *path) const;
+
+#ifdef LATENCY_HISTOGRAMS
+    // Latencies of this allocator's allocate, deallocate and coalesce calls
+    const LatencyStats &get_latency() const;
+#endif
 
 #ifdef BUILD_TESTS
     void log_headers() const;
@@ -51,21 +163,127 @@ class BlockAllocator
 #endif
 
   private:
-    static constexpr size_t INVALID_INT = ~size_t(0);
-
     size_t memory_size = 0;
     char *memory = 0;
+    bool external_memory = false;
 
+    // Headers are stored as a structure of arrays: block sizes, a bitmap of free flags (bit i % 64 of word i / 64),
+    // so the first-fit scan can test several blocks per instruction, and the tag of each block in use.
     size_t header_count = 0;
-    Header *headers = 0;
+    Word *sizes = 0;
+    uint64_t *free_bits = 0;
+    AllocationTag *tags = 0;
 
     size_t empty_headers_start = 0;
 
-    Header *get_free_header(size_t i);
+    size_t epoch = 0;
+
+    CoalescePolicy coalesce_policy = CoalescePolicy::Immediate;
+
+    // in units
+    size_t used_size = 0;
+    size_t peak_used_size = 0;
+    size_t largest_free_size = 0;
+
+    // free blocks per size class, and the largest free block taken away since largest_free_size was last exact
+    size_t free_class_counts[64] = {};
+    size_t removed_largest_size = 0;
+
+    TagCounters tag_counters;
+
+    size_t large_allocation_threshold = 0;
+    LargeRegion *large_regions = 0;
+    size_t mapped_size = 0;
+
+    AllocationTrace *trace = 0;
+
+    AllocationSampler *sampler = 0;
+
+    MemoryBudget *budget = 0;
+
+    std::thread::id owner_thread;
+    size_t min_block_size = 0;
+
+    // blocks freed by threads other than owner_thread, each holding a pointer to the next
+    std::atomic<void *> remote_frees{0};
+
+    // A run of free blocks spanning whole pages, as seen by the last release_idle_memory
+    struct IdleRange
+    {
+        size_t offset;
+        size_t size;
+        size_t passes;
+        // pages released so far, from the end of the range
+        size_t released_size;
+    };
+
+    std::vector<IdleRange> idle_ranges;
+
+    // bytes [reused_begin, reused_end) of the arena span every block allocated since the last release_idle_memory, so
+    // ranges it overlaps start idling over
+    size_t reused_begin = INVALID_INT;
+    size_t reused_end = 0;
+
+#ifdef LATENCY_HISTOGRAMS
+    LatencyStats latency;
+#endif
+
+    void set_layout(char *buffer);
+
+    void release_memory();
+
+    bool is_free(size_t i) const;
+
+    void set_free(size_t i, bool free);
+
+    bool is_free_block(size_t i) const;
+
+    void *allocate_first_fit(size_t units, size_t alignment_units);
+
+    bool is_in_arena(const void *mem) const;
+
+    // the index of the block starting at mem, or INVALID_INT
+    size_t find_block(const void *mem) const;
+
+    void *allocate_large(size_t size, size_t alignment);
+
+    void deallocate_large(void *mem);
+
+    void *reallocate_large(void *mem, size_t size);
+
+    void link_large_region(LargeRegion *region);
+
+    void unlink_large_region(LargeRegion *region);
+
+    void free_large_regions();
+
+    void push_remote_free(void *mem);
+
+    void drain_remote_frees();
 
     bool shift_memory(size_t &i, size_t left, size_t right);
 
-    void coalesce_adjacent_blocks(size_t i);
+    void insert_headers(size_t i, size_t count);
+
+    void erase_header(size_t i);
+
+    void merge_blocks(size_t left);
+
+    // returns the index of the merged block
+    size_t coalesce_adjacent_blocks(size_t i);
 
-    void shift_empty_header(size_t i);
+    void clear_free_blocks();
+
+    // count block i in or out of the free blocks, before it is flagged in use or after it is flagged free
+    void add_free_block(size_t i);
+
+    void remove_free_block(size_t i);
+
+    // makes largest_free_size exact again after a call that removed the largest free block
+    void resolve_largest_free();
 };
+
+using BlockAllocator = BasicBlockAllocator<>;
+
+// For arenas under 4 GiB: half the header footprint of BlockAllocator, with sizes rounded up to max_align_t
+using CompactBlockAllocator = BasicBlockAllocator<uint32_t, alignof(std::max_align_t)>;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cassert>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
@@ -10,19 +11,43 @@ class Chunk
     Chunk() = default;
     Chunk(size_t size);
     void init(size_t size);
+
+    // Places the segments and bitmap in buffer, which must hold get_buffer_size(size) bytes. The chunk does not free
+    // buffer.
+    Chunk(void *buffer, size_t size);
+    void init(void *buffer, size_t size);
+
+    static size_t get_buffer_size(size_t size);
     ~Chunk();
 
     void *allocate(size_t bytes_requested);
 
     bool free(void *segment, size_t size);
 
+    size_t get_size() const;
+
+    size_t get_free_bytes() const;
+
+    // O(number of segment sizes), from the count of free segments of each size
+    size_t get_largest_free_segment() const;
+
+    // Returns the pages of the chunk to the OS with madvise, at most max_bytes at a time, once it has been empty at more
+    // than idle_passes consecutive calls; returns the bytes released. Released pages read as zeros, as freed segments do.
+    // Always 0 for a chunk in a caller's buffer.
+    size_t release_if_idle(size_t idle_passes, size_t max_bytes);
+
+    // Writes an order record per segment size, in the HeapDump format
+    void dump_orders(FILE *file, size_t chunk_index) const;
+
     operator bool();
 
   private:
-    void set_bitmap_size();
+    void set_sizes(size_t size);
 
     void set_free(bool free, size_t offset, size_t segment_size);
 
+    bool is_bit_set(size_t bit_index) const;
+
     char *memory = 0;
     size_t memory_size = 0;
 
@@ -32,4 +57,14 @@ class Chunk
     size_t max_segments_count = 1;
 
     size_t free_bytes_count = 0;
+
+    // free bits per segment size, finest first, so allocate and get_largest_free_segment need not scan for one
+    size_t free_segment_counts[64] = {};
+
+    bool external_memory = false;
+
+    size_t empty_passes = 0, released_bytes = 0;
+
+    // incremented by allocate, so a chunk filled and emptied between two release_if_idle calls is idle anew
+    size_t allocation_count = 0, released_allocation_count = 0;
 };
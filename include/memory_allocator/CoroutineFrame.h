@@ -0,0 +1,232 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+
+#include "memory_allocator/Chunk.h"
+#include "memory_allocator/LinearAllocator.h"
+
+// A thread's pool of coroutine frames. Frames are carved from a Chunk in power-of-two size classes, and a freed frame
+// goes onto its class's free list for the next coroutine of that size, so creating a coroutine is usually a pop. A
+// frame freed on another thread is handed back to the pool that carved it, which takes it on its next miss. The pool
+// keeps what it has carved until the thread has exited and the last of its frames is freed.
+class CoroutineFramePool
+{
+  public:
+    explicit CoroutineFramePool(size_t size);
+
+    CoroutineFramePool(const CoroutineFramePool &) = delete;
+    CoroutineFramePool &operator=(const CoroutineFramePool &) = delete;
+
+    // Returns 0 when the chunk is full
+    void *allocate(size_t size)
+    {
+        size_t size_class = get_size_class(size);
+        FreeFrame *frame = free_lists[size_class];
+
+        if (!frame && remote_frees.load(std::memory_order_relaxed))
+        {
+            drain_remote_frees();
+            frame = free_lists[size_class];
+        }
+
+        if (!frame)
+        {
+            void *mem = chunk.allocate(MIN_FRAME_SIZE << size_class);
+            live_frames += mem != 0;
+
+            return mem;
+        }
+
+        free_lists[size_class] = frame->next;
+        ++live_frames;
+
+        return frame;
+    }
+
+    // On the pool's thread
+    void deallocate(void *mem, size_t size)
+    {
+        size_t size_class = get_size_class(size);
+        FreeFrame *frame = static_cast<FreeFrame *>(mem);
+
+        frame->next = free_lists[size_class];
+        free_lists[size_class] = frame;
+        --live_frames;
+    }
+
+    // On any other thread, including once the pool's has exited
+    void deallocate_remote(void *mem, size_t size);
+
+    // bytes of the chunk not yet carved into frames
+    size_t get_free_bytes() const
+    {
+        return chunk.get_free_bytes();
+    }
+
+    // The calling thread's pool, of 1 MiB
+    static CoroutineFramePool &get_thread();
+
+    // The calling thread's pool if get_thread() has created it and the thread is not exiting, else 0. Never creates one.
+    static CoroutineFramePool *find_thread();
+
+    // Called as the pool's thread exits; deletes the pool now if none of its frames is alive, else when the last one is
+    // freed
+    void release();
+
+  private:
+    // the smallest segment of a Chunk
+    static constexpr size_t MIN_FRAME_SIZE = 32;
+
+    struct FreeFrame
+    {
+        FreeFrame *next;
+
+        // set by deallocate_remote
+        size_t size_class;
+    };
+
+    static size_t get_size_class(size_t size)
+    {
+        size_t size_class = 0;
+
+        while ((MIN_FRAME_SIZE << size_class) < size)
+        {
+            ++size_class;
+        }
+
+        return size_class;
+    }
+
+    void drain_remote_frees();
+
+    Chunk chunk;
+
+    FreeFrame *free_lists[64] = {};
+
+    // allocated minus freed on the pool's thread
+    size_t live_frames = 0;
+
+    // frames freed on other threads, each holding a pointer to the next
+    std::atomic<FreeFrame *> remote_frees{0};
+
+    // frames freed on other threads, counting up; release() takes live_frames from it, so it reaches 0 when the last
+    // frame is freed
+    std::atomic<size_t> remote_free_count{0};
+};
+
+// Derive a C++20 coroutine's promise_type from CoroutineFrameAllocation to take its frames off the global heap. By
+// default a frame comes from the calling thread's CoroutineFramePool, falling back to operator new when the pool is
+// full; either may be destroyed on any thread. A coroutine whose parameters start with std::allocator_arg and a
+// LinearAllocator (after the object, for member functions) has its frame placed in that allocator instead, and frees it
+// with the allocator, e.g. at the end of the request:
+//
+//     Task handle(std::allocator_arg_t, LinearAllocator &request_arena, Connection &connection);
+//
+//     LinearAllocator request_arena(buffer, sizeof(buffer));
+//     Task task = handle(std::allocator_arg, request_arena, connection);
+class CoroutineFrameAllocation
+{
+  public:
+    static void *operator new(size_t size)
+    {
+        size_t total = sizeof(FrameHeader) + size;
+        CoroutineFramePool &pool = CoroutineFramePool::get_thread();
+        void *mem = pool.allocate(total);
+
+        return mem ? init_header(mem, FrameSource::Pool, &pool)
+                   : init_header(::operator new(total), FrameSource::Heap, 0);
+    }
+
+    template <typename... Args>
+    static void *operator new(size_t size, std::allocator_arg_t, LinearAllocator &allocator, Args &...)
+    {
+        return allocate_linear(size, allocator);
+    }
+
+    template <typename Object, typename... Args>
+    static void *operator new(size_t size, Object &, std::allocator_arg_t, LinearAllocator &allocator, Args &...)
+    {
+        return allocate_linear(size, allocator);
+    }
+
+    static void operator delete(void *mem, size_t size)
+    {
+        FrameHeader *header = static_cast<FrameHeader *>(mem) - 1;
+
+        switch (header->source)
+        {
+        case FrameSource::Pool:
+            // a thread without a pool of its own, or past destroying it, frees remotely
+            if (header->pool == CoroutineFramePool::find_thread())
+            {
+                header->pool->deallocate(header, sizeof(FrameHeader) + size);
+            }
+            else
+            {
+                header->pool->deallocate_remote(header, sizeof(FrameHeader) + size);
+            }
+            break;
+
+        case FrameSource::Heap:
+            ::operator delete(header);
+            break;
+
+        // freed with the allocator
+        case FrameSource::Linear:
+            break;
+        }
+    }
+
+    // Match the placement forms of operator new. Frames are freed by the operator delete above; these free nothing,
+    // as the memory belongs to the LinearAllocator.
+    template <typename... Args> static void operator delete(void *, std::allocator_arg_t, LinearAllocator &, Args &...)
+    {
+    }
+
+    template <typename Object, typename... Args>
+    static void operator delete(void *, Object &, std::allocator_arg_t, LinearAllocator &, Args &...)
+    {
+    }
+
+  private:
+    enum class FrameSource : uint8_t
+    {
+        Pool,
+        Heap,
+        Linear,
+    };
+
+    // Keeps frames aligned like operator new
+    struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) FrameHeader
+    {
+        // the pool that carved a Pool frame
+        CoroutineFramePool *pool;
+
+        FrameSource source;
+    };
+
+    static void *init_header(void *mem, FrameSource source, CoroutineFramePool *pool)
+    {
+        FrameHeader *header = static_cast<FrameHeader *>(mem);
+        header->pool = pool;
+        header->source = source;
+
+        return header + 1;
+    }
+
+    static void *allocate_linear(size_t size, LinearAllocator &allocator)
+    {
+        void *mem = allocator.allocate<FrameHeader>(1 + (size + sizeof(FrameHeader) - 1) / sizeof(FrameHeader));
+
+        if (!mem)
+        {
+            throw std::bad_alloc();
+        }
+
+        return init_header(mem, FrameSource::Linear, 0);
+    }
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "memory_allocator/MappedSegmentAllocator.h"
+
+// Epoch-based reclamation for lock-free structures whose readers may still hold a node after it is unlinked. Readers
+// hold a Guard while they can see nodes; unlinked nodes are retired instead of freed, and are freed once every reader
+// that might have seen them has let go, i.e. after the global epoch has advanced twice past their retirement.
+//
+// A Guard costs one store of the current epoch to a thread-local slot, and one to clear it. Retired blocks go to a
+// list of the retiring thread's own, and every batch_size retirements the thread tries to advance the epoch and frees
+// the blocks that have become safe, on that thread. Blocks a thread leaves when it exits are freed by whichever thread
+// collects next, so their allocator must then accept frees from that thread. A thread keeps a Record in each of up to
+// THREAD_RECLAIMERS reclaimers, so guards on different reclaimers nest; using another hands back the Record of one
+// that is not guarded, and a Guard on one more than THREAD_RECLAIMERS guarded reclaimers throws std::runtime_error.
+//
+//     EpochReclaimer reclaimer;
+//
+//     // reader
+//     EpochReclaimer::Guard guard(reclaimer);
+//     Node *node = head.load(std::memory_order_acquire);
+//
+//     // writer, after unlinking node
+//     reclaimer.retire(allocator, node);
+class EpochReclaimer
+{
+    struct Record;
+
+  public:
+    static constexpr size_t THREAD_RECLAIMERS = 4;
+
+    using FreeFunction = void (*)(void *context, void *mem);
+
+    explicit EpochReclaimer(size_t batch_size = 64);
+
+    // Frees everything retired; no thread may be reading or retiring
+    ~EpochReclaimer();
+
+    EpochReclaimer(const EpochReclaimer &) = delete;
+    EpochReclaimer &operator=(const EpochReclaimer &) = delete;
+
+    // Guards nest
+    class Guard
+    {
+      public:
+        explicit Guard(EpochReclaimer &reclaimer);
+        ~Guard();
+
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+
+      private:
+        Record *record;
+    };
+
+    // free(context, mem) is called once no reader can still see mem
+    void retire(void *mem, FreeFunction free, void *context);
+
+    // BlockAllocator, CompactBlockAllocator, PoolAllocator and SharedBlockAllocator
+    template <typename Allocator> void retire(Allocator &allocator, void *mem)
+    {
+        retire(mem, [](void *context, void *mem) { static_cast<Allocator *>(context)->deallocate(mem); }, &allocator);
+    }
+
+    // destroys the object when it is freed
+    template <typename T> void retire(MappedSegmentAllocator &allocator, T *mem)
+    {
+        retire(
+            const_cast<void *>(static_cast<const void *>(mem)),
+            [](void *context, void *mem) { static_cast<MappedSegmentAllocator *>(context)->free(static_cast<T *>(mem)); },
+            &allocator);
+    }
+
+    // a value made with AdapterType::emplace; destroyed and freed with AdapterType::remove
+    template <typename AdapterType> void retire(typename AdapterType::value_type *value)
+    {
+        using ValueType = typename AdapterType::value_type;
+
+        retire(
+            value, [](void *, void *mem) { AdapterType::remove(static_cast<ValueType *>(mem)); }, 0);
+    }
+
+    // Advances the epoch if every reader has seen the current one, and frees this thread's retired blocks (and those
+    // of exited threads) that are now safe. Returns the number freed.
+    size_t collect();
+
+    uint64_t get_epoch() const;
+
+    // blocks retired and not yet freed, across all threads
+    size_t get_pending_count() const;
+
+  private:
+    struct Retired
+    {
+        void *mem;
+        FreeFunction free;
+        void *context;
+        uint64_t epoch;
+    };
+
+    // A thread's slot. Padded to a cache line so readers announcing never share a line.
+    struct alignas(64) Record
+    {
+        // the epoch a reader announced, or 0 outside guards
+        std::atomic<uint64_t> announced{0};
+        size_t depth = 0;
+
+        std::vector<Retired> retired;
+        bool in_use = false;
+    };
+
+    // the calling thread's Record in this reclaimer
+    Record *get_record();
+
+    Record *acquire_record();
+
+    void release_record(Record *record);
+
+    bool try_advance();
+
+    size_t free_safe(std::vector<Retired> &retired, uint64_t epoch);
+
+    uint64_t id;
+    size_t batch_size;
+
+    std::atomic<uint64_t> epoch{1};
+    std::atomic<size_t> pending_count{0};
+
+    mutable std::mutex mutex;
+    std::deque<Record> records;
+    std::vector<Retired> orphans;
+
+    friend struct EpochThreadState;
+};
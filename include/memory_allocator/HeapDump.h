@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A heap dump is a CSV file with one record per line, the first field naming the record:
+//
+//   # memory_allocator heap dump 1
+//   arena,<capacity>,<headers used>,<header capacity>
+//   block,<offset>,<size>,<free|used>,<tag>
+//   chunk,<index>,<size>
+//   order,<chunk index>,<segment size>,<free segments>,<segments>
+//
+// Sizes and offsets are in bytes. BlockAllocator writes one arena record and its blocks in address order;
+// MappedSegmentAllocator writes one arena record and, for each chunk, a chunk record and one order record per
+// segment size, smallest first.
+struct HeapDump
+{
+    static constexpr const char *HEADER = "# memory_allocator heap dump 1";
+
+    struct Block
+    {
+        size_t offset;
+        size_t size;
+        bool free;
+        uint32_t tag;
+    };
+
+    struct Order
+    {
+        size_t chunk;
+        size_t segment_size;
+        size_t free_segments;
+        size_t segment_count;
+    };
+
+    size_t capacity = 0;
+    size_t headers_used = 0;
+    size_t header_capacity = 0;
+
+    std::vector<Block> blocks;
+    std::vector<size_t> chunk_sizes;
+    std::vector<Order> orders;
+
+    static bool read(const char *path, HeapDump &dump);
+};
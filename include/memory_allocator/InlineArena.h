@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+
+#include "memory_allocator/BlockAllocator.h"
+
+template <size_t BufferSize> struct InlineArenaStorage
+{
+    alignas(std::max_align_t) char buffer[BufferSize];
+};
+
+// A BlockAllocator whose arena and headers are embedded in the object, so an arena on the stack, or a static one, makes
+// no heap call. Allocations past MemorySize still fail rather than fall back to the heap.
+//
+//     InlineArena<4096> arena;
+//     void *mem = arena.allocate(100);
+//
+// As an Adapter's allocator, every container of the group shares one static arena:
+//
+//     std::vector<int, Adapter<int, InlineArena<64 * 1024>>> values;
+template <size_t MemorySize, size_t MaxBlockCount = 64, typename Allocator = BlockAllocator>
+class InlineArena : private InlineArenaStorage<Allocator::get_buffer_size(MemorySize, MaxBlockCount)>, public Allocator
+{
+  public:
+    // the storage base is constructed first, so the allocator can lay itself out in it
+    InlineArena() : Allocator(this->buffer, MemorySize, MaxBlockCount)
+    {
+    }
+
+    InlineArena(const InlineArena &) = delete;
+    InlineArena &operator=(const InlineArena &) = delete;
+};
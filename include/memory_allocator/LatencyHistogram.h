@@ -0,0 +1,93 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Counts nanosecond latencies in log-linear buckets: exact below 4 ns, then 4 buckets per power of two, so any
+// reported value is within 25% of the true one. Recording is a bucket lookup and two increments.
+class LatencyHistogram
+{
+  public:
+    static constexpr size_t BUCKET_COUNT = 252;
+
+    void record(uint64_t nanoseconds)
+    {
+        ++counts[get_bucket(nanoseconds)];
+        ++count;
+        max = nanoseconds > max ? nanoseconds : max;
+    }
+
+    void merge(const LatencyHistogram &other);
+
+    void clear();
+
+    uint64_t get_count() const
+    {
+        return count;
+    }
+
+    uint64_t get_max() const
+    {
+        return max;
+    }
+
+    // The upper bound of the bucket holding the given percentile (0-100], capped at the maximum recorded; 0 when
+    // empty.
+    uint64_t get_percentile(double percentile) const;
+
+  private:
+    static size_t get_bucket(uint64_t nanoseconds)
+    {
+        if (nanoseconds < 4)
+        {
+            return nanoseconds;
+        }
+
+        size_t msb = 63 - __builtin_clzll(nanoseconds);
+
+        return (msb - 1) * 4 + ((nanoseconds >> (msb - 2)) & 3);
+    }
+
+    static uint64_t get_bucket_upper_bound(size_t bucket);
+
+    uint64_t counts[BUCKET_COUNT] = {};
+    uint64_t count = 0;
+    uint64_t max = 0;
+};
+
+// The operations an allocator times when built with LATENCY_HISTOGRAMS
+struct LatencyStats
+{
+    LatencyHistogram allocate;
+    LatencyHistogram deallocate;
+    LatencyHistogram coalesce;
+
+    // Latencies of every instrumented allocator operation made on the calling thread
+    static LatencyStats &get_thread();
+};
+
+// Records the time from construction to destruction in an allocator's histogram and the calling thread's
+class LatencyTimer
+{
+  public:
+    LatencyTimer(LatencyHistogram &instance, LatencyHistogram &thread)
+        : instance(instance), thread(thread), start(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~LatencyTimer()
+    {
+        uint64_t nanoseconds =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        instance.record(nanoseconds);
+        thread.record(nanoseconds);
+    }
+
+  private:
+    LatencyHistogram &instance;
+    LatencyHistogram &thread;
+
+    std::chrono::steady_clock::time_point start;
+};
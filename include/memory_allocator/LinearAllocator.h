@@ -1,25 +1,55 @@
+#pragma once
+
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 
 #include <utility>
 
+#include "memory_allocator/AllocatorStats.h"
+#include "memory_allocator/MemoryBudget.h"
+
 class LinearAllocator
 {
   public:
     LinearAllocator(size_t size);
 
+    // Allocates from buffer, which the allocator zeroes and does not free
+    LinearAllocator(void *buffer, size_t size);
+
     ~LinearAllocator();
 
+    // Rounds the cursor up to alignof(T) first
     template <typename T> T *allocate(size_t n = 1)
     {
+        // the padding is known only once the pressure callbacks have run, so the most it can be is reserved
+        size_t reserved = n * sizeof(T) + alignof(T) - 1;
+        if (budget && !budget->reserve(reserved))
+        {
+            return 0;
+        }
+
         T *p = 0;
 
-        char *next = cursor + n * sizeof(T);
+        char *start = cursor + (-reinterpret_cast<uintptr_t>(cursor) & (alignof(T) - 1));
+        char *next = start + n * sizeof(T);
         if (next <= end)
         {
-            p = reinterpret_cast<T *>(cursor);
+            if (budget)
+            {
+                reserved -= next - cursor;
+            }
+
+            p = reinterpret_cast<T *>(start);
             cursor = next;
+
+            peak = cursor > peak ? cursor : peak;
+        }
+
+        if (budget)
+        {
+            budget->release(reserved);
         }
 
         return p;
@@ -39,6 +69,21 @@ class LinearAllocator
 
     void free(void *mem);
 
+    // Frees every allocation, zeroing only the bytes that were used
+    void reset();
+
+    // Counts the bytes up to the cursor, padding included, against budget's limits: past the hard limit allocate
+    // returns 0. Set it before allocating; 0 removes it.
+    void set_budget(MemoryBudget *budget);
+
+    AllocatorStats get_stats() const;
+
   private:
     char *begin, *cursor, *end;
+
+    char *peak;
+
+    bool external_memory;
+
+    MemoryBudget *budget = 0;
 };
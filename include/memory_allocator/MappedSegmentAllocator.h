@@ -4,7 +4,10 @@
 #include <cstring>
 #include <utility>
 
+#include "memory_allocator/AllocationTrace.h"
+#include "memory_allocator/AllocatorStats.h"
 #include "memory_allocator/Chunk.h"
+#include "memory_allocator/MemoryBudget.h"
 
 class MappedSegmentAllocator
 {
@@ -14,22 +17,45 @@ class MappedSegmentAllocator
 
     bool add_chunk(size_t size);
 
+    // Adds a chunk over buffer, which must hold Chunk::get_buffer_size(size) bytes and outlive the allocator
+    bool add_chunk(void *buffer, size_t size);
+
     template <typename T> T *allocate(size_t n = 1)
     {
         T *mem = 0;
         size_t size = n * sizeof(T);
 
+        if (budget && !budget->reserve(size))
+        {
+            return 0;
+        }
+
         for (size_t i = 0; i < chunk_count; ++i)
         {
             Chunk *c = chunks + i;
+
+            size_t free_bytes = c->get_free_bytes();
             mem = static_cast<T *>(c->allocate(size));
 
             if (mem)
             {
+                used_bytes += free_bytes - c->get_free_bytes();
+                peak_used_bytes = used_bytes > peak_used_bytes ? used_bytes : peak_used_bytes;
+
                 break;
             }
         }
 
+        if (!mem && budget)
+        {
+            budget->release(size);
+        }
+
+        if (trace)
+        {
+            trace->record_allocate(mem, size, alignof(T));
+        }
+
         return mem;
     }
 
@@ -52,11 +78,25 @@ class MappedSegmentAllocator
 
     template <typename T> void deallocate(T *mem, size_t n = 1)
     {
+        if (trace)
+        {
+            trace->record_deallocate(mem);
+        }
+
         for (size_t i = 0; i < chunk_count; ++i)
         {
-            if ((chunks + i)->free(mem, sizeof(T)))
+            size_t free_bytes = (chunks + i)->get_free_bytes();
+
+            if ((chunks + i)->free(mem, n * sizeof(T)))
             {
-                memset(mem, 0, sizeof(T));
+                used_bytes -= (chunks + i)->get_free_bytes() - free_bytes;
+
+                if (budget)
+                {
+                    budget->release(n * sizeof(T));
+                }
+
+                memset(mem, 0, n * sizeof(T));
 
                 return;
             }
@@ -65,10 +105,24 @@ class MappedSegmentAllocator
 
     template <typename T> void free(T *mem)
     {
+        if (trace)
+        {
+            trace->record_deallocate(mem);
+        }
+
         for (size_t i = 0; i < chunk_count; ++i)
         {
+            size_t free_bytes = (chunks + i)->get_free_bytes();
+
             if ((chunks + i)->free(mem, sizeof(T)))
             {
+                used_bytes -= (chunks + i)->get_free_bytes() - free_bytes;
+
+                if (budget)
+                {
+                    budget->release(sizeof(T));
+                }
+
                 mem->~T();
 
                 memset(mem, 0, sizeof(T));
@@ -78,8 +132,35 @@ class MappedSegmentAllocator
         }
     }
 
+    // Records every allocate and deallocate to trace; 0 stops tracing.
+    void set_trace(AllocationTrace *trace)
+    {
+        MappedSegmentAllocator::trace = trace;
+    }
+
+    // Counts the requested bytes against budget's limits: past the hard limit allocate returns 0. Set it before
+    // allocating; 0 removes it.
+    void set_budget(MemoryBudget *budget);
+
+    // Returns the pages of chunks that were empty at more than idle_passes consecutive calls to the OS, releasing at most
+    // max_bytes; returns the bytes released. The chunks stay allocated, so reusing them costs a page fault.
+    size_t release_idle_memory(size_t idle_passes, size_t max_bytes = ~size_t(0));
+
+    // O(1) per chunk: the largest free block comes from each chunk's count of free segments per size.
+    AllocatorStats get_stats() const;
+
+    // Writes each chunk's occupancy per segment size to path in the HeapDump format. Returns false if the file cannot
+    // be written.
+    bool dump(const char *path) const;
+
   private:
     Chunk *chunks = 0;
 
     size_t chunk_count = 0, max_chunks = 20;
+
+    size_t capacity = 0, used_bytes = 0, peak_used_bytes = 0;
+
+    AllocationTrace *trace = 0;
+
+    MemoryBudget *budget = 0;
 };
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// Soft and hard limits on the bytes an allocator hands out. When usage crosses the soft limit the pressure callbacks
+// run, before the allocation that crossed it is made, so caches can evict and allocations need not fail; they run
+// again the next time usage crosses it from below. An allocation that would take usage past the hard limit fails, as
+// if the arena were full.
+//
+// BlockAllocator, PoolAllocator, LinearAllocator and MappedSegmentAllocator take a budget through set_budget;
+// SharedBlockAllocator does not, as its state is shared between processes.
+//
+// Like the allocators, a budget is not thread-safe: give each allocator its own, or synchronize externally.
+class MemoryBudget
+{
+  public:
+    // called with the bytes in use, counting the allocation being made
+    using PressureCallback = std::function<void(size_t bytes_in_use)>;
+
+    explicit MemoryBudget(size_t soft_limit = ~size_t(0), size_t hard_limit = ~size_t(0));
+
+    void set_limits(size_t soft_limit, size_t hard_limit);
+
+    // Callbacks may free memory from the allocator, which the allocation then can use
+    void add_pressure_callback(PressureCallback callback);
+
+    // Counts size against the limits; returns false, counting nothing, past the hard limit
+    bool reserve(size_t size)
+    {
+        if (bytes_in_use + size > check_limit)
+        {
+            return reserve_checked(size);
+        }
+
+        bytes_in_use += size;
+
+        return true;
+    }
+
+    void release(size_t size)
+    {
+        bytes_in_use -= size;
+    }
+
+    size_t get_bytes_in_use() const;
+
+    size_t get_soft_limit() const;
+
+    size_t get_hard_limit() const;
+
+  private:
+    bool reserve_checked(size_t size);
+
+    size_t soft_limit;
+    size_t hard_limit;
+
+    // the lower of the two, so reserving under both costs one compare
+    size_t check_limit;
+
+    size_t bytes_in_use = 0;
+
+    std::vector<PressureCallback> callbacks;
+
+    // callbacks that allocate do not run the callbacks again
+    bool notifying = false;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Returns memory that has sat free for a while to the OS from a background thread, so the resident set follows the
+// recent working set rather than the peak. Every interval the scavenger makes a pass over its allocators, and each
+// releases the free ranges (BlockAllocator) or empty chunks (MappedSegmentAllocator) that have stayed free for
+// idle_time. A pass releases at most max_bytes_per_second times the interval, so a burst of releases, and the page
+// faults of reusing the memory afterwards, are spread out.
+//
+// Passes run on the scavenger's thread, so each allocator is released under the lock its other users take:
+//
+//     MemoryScavenger scavenger(std::chrono::seconds(1), std::chrono::seconds(10), 64 << 20);
+//     scavenger.add(allocator, mutex);
+//
+// Allocators must outlive the scavenger.
+class MemoryScavenger
+{
+  public:
+    // called with the passes a range must have stayed free and the most bytes to release; returns the bytes released
+    using ReleaseFunction = std::function<size_t(size_t idle_passes, size_t max_bytes)>;
+
+    MemoryScavenger(std::chrono::milliseconds interval, std::chrono::milliseconds idle_time,
+                    size_t max_bytes_per_second = ~size_t(0));
+    ~MemoryScavenger();
+
+    MemoryScavenger(const MemoryScavenger &) = delete;
+    MemoryScavenger &operator=(const MemoryScavenger &) = delete;
+
+    void add(ReleaseFunction release);
+
+    // BlockAllocator, CompactBlockAllocator and MappedSegmentAllocator
+    template <typename Allocator> void add(Allocator &allocator, std::mutex &mutex)
+    {
+        add([&allocator, &mutex](size_t idle_passes, size_t max_bytes) {
+            std::lock_guard<std::mutex> lock(mutex);
+            return allocator.release_idle_memory(idle_passes, max_bytes);
+        });
+    }
+
+    // Makes a pass now, on the calling thread. Returns the bytes released.
+    size_t scavenge();
+
+    // bytes released by all passes so far
+    size_t get_released_bytes() const;
+
+  private:
+    size_t scavenge_locked();
+
+    void run();
+
+    std::chrono::milliseconds interval;
+    size_t idle_passes;
+    size_t max_bytes_per_pass;
+
+    mutable std::mutex mutex;
+    std::condition_variable stop_requested;
+
+    std::vector<ReleaseFunction> releases;
+    size_t released_bytes = 0;
+
+    bool stopping = false;
+
+    std::thread worker;
+};
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+
+// A pointer stored as the distance from its own address to the target, so an object holding one stays valid when the
+// memory containing both is mapped at another address. Adapter uses it as the pointer type of containers built in a
+// SharedBlockAllocator. Offset 1 is null, as no object starts one byte into an OffsetPtr.
+template <typename T> class OffsetPtr
+{
+  public:
+    using element_type = T;
+    using value_type = std::remove_cv_t<T>;
+    using difference_type = ptrdiff_t;
+    using pointer = T *;
+    using reference = std::add_lvalue_reference_t<T>;
+    using iterator_category = std::random_access_iterator_tag;
+
+    OffsetPtr() = default;
+
+    OffsetPtr(std::nullptr_t)
+    {
+    }
+
+    OffsetPtr(T *target)
+    {
+        set(target);
+    }
+
+    OffsetPtr(const OffsetPtr &other)
+    {
+        set(other.get());
+    }
+
+    template <typename U, typename = std::enable_if_t<std::is_convertible<U *, T *>::value>>
+    OffsetPtr(const OffsetPtr<U> &other)
+    {
+        set(other.get());
+    }
+
+    // static_cast, e.g. from OffsetPtr<void>
+    template <typename U, typename = std::enable_if_t<!std::is_convertible<U *, T *>::value>, typename = void>
+    explicit OffsetPtr(const OffsetPtr<U> &other)
+    {
+        set(static_cast<T *>(other.get()));
+    }
+
+    OffsetPtr &operator=(const OffsetPtr &other)
+    {
+        set(other.get());
+
+        return *this;
+    }
+
+    OffsetPtr &operator=(T *target)
+    {
+        set(target);
+
+        return *this;
+    }
+
+    T *get() const
+    {
+        return offset == NULL_OFFSET ? 0 : reinterpret_cast<T *>(reinterpret_cast<uintptr_t>(this) + offset);
+    }
+
+    T *operator->() const
+    {
+        return get();
+    }
+
+    template <typename U = T, typename = std::enable_if_t<!std::is_void<U>::value>> U &operator*() const
+    {
+        return *get();
+    }
+
+    template <typename U = T, typename = std::enable_if_t<!std::is_void<U>::value>> U &operator[](ptrdiff_t i) const
+    {
+        return get()[i];
+    }
+
+    explicit operator bool() const
+    {
+        return offset != NULL_OFFSET;
+    }
+
+    template <typename U = T, typename = std::enable_if_t<!std::is_void<U>::value>>
+    static OffsetPtr pointer_to(U &target)
+    {
+        return OffsetPtr(std::addressof(target));
+    }
+
+    OffsetPtr &operator+=(ptrdiff_t n)
+    {
+        offset += n * ptrdiff_t(sizeof(T));
+
+        return *this;
+    }
+
+    OffsetPtr &operator-=(ptrdiff_t n)
+    {
+        offset -= n * ptrdiff_t(sizeof(T));
+
+        return *this;
+    }
+
+    OffsetPtr &operator++()
+    {
+        return *this += 1;
+    }
+
+    OffsetPtr &operator--()
+    {
+        return *this -= 1;
+    }
+
+    OffsetPtr operator++(int)
+    {
+        OffsetPtr previous(*this);
+        ++*this;
+
+        return previous;
+    }
+
+    OffsetPtr operator--(int)
+    {
+        OffsetPtr previous(*this);
+        --*this;
+
+        return previous;
+    }
+
+    friend OffsetPtr operator+(OffsetPtr p, ptrdiff_t n)
+    {
+        return p += n;
+    }
+
+    friend OffsetPtr operator+(ptrdiff_t n, OffsetPtr p)
+    {
+        return p += n;
+    }
+
+    friend OffsetPtr operator-(OffsetPtr p, ptrdiff_t n)
+    {
+        return p -= n;
+    }
+
+    friend ptrdiff_t operator-(const OffsetPtr &a, const OffsetPtr &b)
+    {
+        return a.get() - b.get();
+    }
+
+    friend bool operator==(const OffsetPtr &a, const OffsetPtr &b)
+    {
+        return a.get() == b.get();
+    }
+
+    friend bool operator!=(const OffsetPtr &a, const OffsetPtr &b)
+    {
+        return a.get() != b.get();
+    }
+
+    friend bool operator<(const OffsetPtr &a, const OffsetPtr &b)
+    {
+        return a.get() < b.get();
+    }
+
+    friend bool operator>(const OffsetPtr &a, const OffsetPtr &b)
+    {
+        return a.get() > b.get();
+    }
+
+    friend bool operator<=(const OffsetPtr &a, const OffsetPtr &b)
+    {
+        return a.get() <= b.get();
+    }
+
+    friend bool operator>=(const OffsetPtr &a, const OffsetPtr &b)
+    {
+        return a.get() >= b.get();
+    }
+
+    friend bool operator==(const OffsetPtr &p, std::nullptr_t)
+    {
+        return !p;
+    }
+
+    friend bool operator!=(const OffsetPtr &p, std::nullptr_t)
+    {
+        return bool(p);
+    }
+
+  private:
+    static constexpr ptrdiff_t NULL_OFFSET = 1;
+
+    void set(T *target)
+    {
+        offset = target ? ptrdiff_t(reinterpret_cast<uintptr_t>(target) - reinterpret_cast<uintptr_t>(this))
+                        : NULL_OFFSET;
+    }
+
+    ptrdiff_t offset = NULL_OFFSET;
+};
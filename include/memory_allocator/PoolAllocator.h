@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+
+#include "memory_allocator/AllocationTrace.h"
+#include "memory_allocator/AllocatorStats.h"
+#include "memory_allocator/MemoryBudget.h"
+
+class PoolAllocator
+{
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    struct Slab
+    {
+        Slab *next;
+    };
+
+  public:
+    PoolAllocator() = default;
+
+    constexpr PoolAllocator(size_t block_size, size_t alignment = alignof(std::max_align_t),
+                            size_t blocks_per_slab = 64)
+        : block_size(get_block_stride(block_size, alignment)), alignment(get_block_alignment(alignment)),
+          blocks_per_slab(blocks_per_slab)
+    {
+    }
+
+    void init(size_t block_size, size_t alignment = alignof(std::max_align_t), size_t blocks_per_slab = 64);
+
+    ~PoolAllocator();
+
+    void *allocate()
+    {
+        if (budget && !budget->reserve(block_size))
+        {
+            return 0;
+        }
+
+        if (!free_list && !add_slab())
+        {
+            if (budget)
+            {
+                budget->release(block_size);
+            }
+
+            return 0;
+        }
+
+        FreeBlock *block = free_list;
+        free_list = block->next;
+
+        ++live_count;
+        peak_live_count = live_count > peak_live_count ? live_count : peak_live_count;
+
+        if (trace)
+        {
+            trace->record_allocate(block, block_size, alignment);
+        }
+
+        return block;
+    }
+
+    void deallocate(void *mem)
+    {
+        if (trace)
+        {
+            trace->record_deallocate(mem);
+        }
+
+        FreeBlock *block = static_cast<FreeBlock *>(mem);
+
+        block->next = free_list;
+        free_list = block;
+
+        --live_count;
+
+        if (budget)
+        {
+            budget->release(block_size);
+        }
+    }
+
+    size_t get_block_size() const
+    {
+        return block_size;
+    }
+
+    // Records every allocate and deallocate to trace; 0 stops tracing.
+    void set_trace(AllocationTrace *trace)
+    {
+        PoolAllocator::trace = trace;
+    }
+
+    // Counts blocks against budget's limits: past the hard limit allocate returns 0. Set it before allocating; 0
+    // removes it.
+    void set_budget(MemoryBudget *budget)
+    {
+        PoolAllocator::budget = budget;
+    }
+
+    AllocatorStats get_stats() const;
+
+  private:
+    static constexpr size_t get_block_alignment(size_t alignment)
+    {
+        return alignment < alignof(FreeBlock) ? alignof(FreeBlock) : alignment;
+    }
+
+    // blocks must hold a free list link and keep every block in the slab aligned
+    static constexpr size_t get_block_stride(size_t size, size_t alignment)
+    {
+        size = size < sizeof(FreeBlock) ? sizeof(FreeBlock) : size;
+        alignment = get_block_alignment(alignment);
+
+        return (size + alignment - 1) & ~(alignment - 1);
+    }
+
+    bool add_slab();
+
+    void free_slabs();
+
+    size_t block_size = 0;
+    size_t alignment = alignof(std::max_align_t);
+    size_t blocks_per_slab = 0;
+
+    FreeBlock *free_list = 0;
+    Slab *slabs = 0;
+
+    size_t slab_count = 0;
+    size_t live_count = 0;
+    size_t peak_live_count = 0;
+
+    AllocationTrace *trace = 0;
+
+    MemoryBudget *budget = 0;
+};
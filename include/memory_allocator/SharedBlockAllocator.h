@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+
+#include "memory_allocator/AllocatorStats.h"
+#include "memory_allocator/BlockAllocator.h"
+
+// A BlockAllocator whose arena, headers and state live in a shared memory object, so several processes can build and
+// read the same containers. The object is a POSIX shared memory name; with no name, an anonymous memfd whose
+// descriptor is inherited or passed to the other processes; or a file, which keeps the containers across restarts.
+// Each process may map it at a different address: use Adapter<T, SharedBlockAllocator>, whose pointer type is
+// OffsetPtr, for containers stored in it, and set_root() to publish the top-level object.
+//
+// allocate and deallocate take a process-shared lock. A process that dies holding it may have left the headers half
+// updated, so the next process to take the lock marks the arena poisoned: from then on allocate returns 0 and deallocate
+// does nothing, in every process, and is_poisoned() returns true. Objects already in the arena can still be read, but
+// the heap cannot be trusted again; create a new object, or remove the file, to start over.
+class SharedBlockAllocator
+{
+  public:
+    SharedBlockAllocator() = default;
+
+    // Unmaps the object, which the system frees once no process maps it and its name is removed
+    ~SharedBlockAllocator();
+
+    SharedBlockAllocator(const SharedBlockAllocator &) = delete;
+    SharedBlockAllocator &operator=(const SharedBlockAllocator &) = delete;
+
+    // Creates a shared memory object named name (e.g. "/tables"), replacing any of that name, or an anonymous one if
+    // name is 0, and initializes an arena in it. Returns false if it cannot be created or mapped.
+    bool create(const char *name, size_t memory_size, size_t max_block_count);
+
+    // Maps an object created by another process. Returns false if it cannot be mapped or holds no arena.
+    bool attach(const char *name);
+
+    // Maps the object open as fd, e.g. the get_fd() of an anonymous object, inherited across fork
+    bool attach(int fd);
+
+    // Maps the file at path, first initializing an arena in it if the file is new, empty or was left by a process that
+    // died initializing it, so a restarted process finds the root and containers of the previous run where it left
+    // them. Returns false if the file cannot be created or mapped, or holds something else. The first process to open the file resets its lock, which a file
+    // synced and then kept over a crash of the system may hold.
+    bool open(const char *path, size_t memory_size, size_t max_block_count);
+
+    // Writes the mapping back to its file and waits for the write, taking the lock so no allocation is half done.
+    // Without it, writes still reach the file and later processes through the page cache; sync() is only needed for
+    // the file to survive a crash of the system. Returns false on error.
+    bool sync();
+
+    void detach();
+
+    // The descriptor of the mapped object, or -1
+    int get_fd() const;
+
+    // Removes name, so no new process can attach; mapped objects stay valid
+    static bool remove(const char *name);
+
+    void *allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+    void deallocate(void *mem);
+
+    bool owns(const void *mem) const;
+
+    // Publishes an object allocated in the arena (e.g. a container) for processes that attach later; 0 clears it
+    void set_root(void *root);
+
+    void *get_root() const;
+
+    AllocatorStats get_stats() const;
+
+    // Whether a process died holding the lock; see above
+    bool is_poisoned() const;
+
+#ifdef BUILD_TESTS
+    // Takes the lock and never releases it, as a process that dies in the middle of an allocation does
+    void abandon_lock();
+#endif
+
+  private:
+    struct Control;
+
+    class Lock;
+
+    bool initialize(int fd, size_t memory_size, size_t max_block_count);
+
+    bool map(int fd);
+
+    static size_t get_arena_offset();
+
+    char *get_arena() const;
+
+    Control *control = 0;
+    size_t mapped_size = 0;
+    int fd = -1;
+};
@@ -0,0 +1,130 @@
+#include "memory_allocator/AllocationSampler.h"
+
+#include <cmath>
+#include <cstdio>
+
+#ifdef __linux__
+#include <execinfo.h>
+#endif
+
+AllocationSampler::AllocationSampler(size_t sampling_interval, uint64_t seed)
+    : sampling_interval(sampling_interval), random(seed)
+{
+    bytes_until_sample = get_next_interval();
+}
+
+size_t AllocationSampler::get_sample_count() const
+{
+    return live.size();
+}
+
+void AllocationSampler::sample(const void *mem, size_t size)
+{
+    bytes_until_sample = get_next_interval();
+
+    void *frames[MAX_FRAMES];
+    int frame_count = 0;
+
+#ifdef __linux__
+    frame_count = backtrace(frames, MAX_FRAMES);
+#endif
+
+    // drop this function's own frame
+    std::vector<void *> stack(frames + (frame_count ? 1 : 0), frames + frame_count);
+
+    auto inserted = stack_ids.emplace(std::move(stack), stacks.size());
+    if (inserted.second)
+    {
+        stacks.push_back(&inserted.first->first);
+        totals.emplace_back();
+    }
+
+    size_t id = inserted.first->second;
+
+    totals[id].live_count += 1;
+    totals[id].live_bytes += size;
+    totals[id].total_count += 1;
+    totals[id].total_bytes += size;
+
+    // a block reused before its free was recorded replaces the old sample
+    forget(mem);
+    live[reinterpret_cast<uintptr_t>(mem)] = {size, id};
+}
+
+void AllocationSampler::forget(const void *mem)
+{
+    auto it = live.find(reinterpret_cast<uintptr_t>(mem));
+
+    if (it == live.end())
+    {
+        return;
+    }
+
+    totals[it->second.stack].live_count -= 1;
+    totals[it->second.stack].live_bytes -= it->second.size;
+
+    live.erase(it);
+}
+
+int64_t AllocationSampler::get_next_interval()
+{
+    // -log(U) * mean is exponentially distributed with that mean; U is kept away from 0
+    double uniform = (random() >> 11) * 0x1.0p-53;
+
+    return int64_t(-std::log(1 - uniform) * sampling_interval);
+}
+
+bool AllocationSampler::write_heap_profile(const char *path) const
+{
+    FILE *file = fopen(path, "w");
+
+    if (!file)
+    {
+        return false;
+    }
+
+    Totals sum;
+    for (const Totals &stack_totals : totals)
+    {
+        sum.live_count += stack_totals.live_count;
+        sum.live_bytes += stack_totals.live_bytes;
+        sum.total_count += stack_totals.total_count;
+        sum.total_bytes += stack_totals.total_bytes;
+    }
+
+    fprintf(file, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n", sum.live_count, sum.live_bytes,
+            sum.total_count, sum.total_bytes, sampling_interval);
+
+    for (size_t id = 0; id < stacks.size(); ++id)
+    {
+        fprintf(file, "%zu: %zu [%zu: %zu] @", totals[id].live_count, totals[id].live_bytes, totals[id].total_count,
+                totals[id].total_bytes);
+
+        for (void *frame : *stacks[id])
+        {
+            fprintf(file, " %p", frame);
+        }
+
+        fprintf(file, "\n");
+    }
+
+    // pprof maps the addresses above to binaries with this
+    fprintf(file, "\nMAPPED_LIBRARIES:\n");
+
+    if (FILE *maps = fopen("/proc/self/maps", "r"))
+    {
+        char buffer[4096];
+        size_t read;
+
+        while ((read = fread(buffer, 1, sizeof(buffer), maps)))
+        {
+            fwrite(buffer, 1, read, file);
+        }
+
+        fclose(maps);
+    }
+
+    bool written = !ferror(file);
+
+    return !fclose(file) && written;
+}
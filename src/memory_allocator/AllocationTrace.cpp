@@ -0,0 +1,132 @@
+#include "memory_allocator/AllocationTrace.h"
+
+#include <atomic>
+#include <cstring>
+
+static constexpr char MAGIC[8] = {'M', 'A', 'T', 'R', 'A', 'C', 'E', '1'};
+
+static uint16_t get_thread_index()
+{
+    static std::atomic<uint16_t> thread_count{0};
+    thread_local uint16_t thread_index = thread_count++;
+
+    return thread_index;
+}
+
+AllocationTrace::~AllocationTrace()
+{
+    close();
+}
+
+bool AllocationTrace::open(const char *path)
+{
+    close();
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    file = fopen(path, "wb");
+
+    if (!file)
+    {
+        return false;
+    }
+
+    uint32_t event_size = sizeof(Event);
+
+    fwrite(MAGIC, sizeof(MAGIC), 1, file);
+    fwrite(&event_size, sizeof(event_size), 1, file);
+
+    start = std::chrono::steady_clock::now();
+
+    return true;
+}
+
+void AllocationTrace::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (file)
+    {
+        flush();
+
+        fclose(file);
+        file = 0;
+    }
+}
+
+void AllocationTrace::record_allocate(const void *mem, size_t size, size_t alignment)
+{
+    record(mem, size, alignment, Operation::Allocate);
+}
+
+void AllocationTrace::record_deallocate(const void *mem)
+{
+    record(mem, 0, 1, Operation::Deallocate);
+}
+
+void AllocationTrace::record(const void *mem, size_t size, size_t alignment, Operation operation)
+{
+    Event event;
+
+    event.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start)
+                          .count();
+    event.address = reinterpret_cast<uintptr_t>(mem);
+    event.size = size > UINT32_MAX ? UINT32_MAX : uint32_t(size);
+    event.alignment_log2 = 0;
+    event.operation = operation;
+    event.thread = get_thread_index();
+
+    while (alignment >>= 1)
+    {
+        ++event.alignment_log2;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!file)
+    {
+        return;
+    }
+
+    buffer[buffered++] = event;
+
+    if (buffered == BUFFER_SIZE)
+    {
+        flush();
+    }
+}
+
+void AllocationTrace::flush()
+{
+    fwrite(buffer, sizeof(Event), buffered, file);
+    buffered = 0;
+}
+
+bool AllocationTrace::read(const char *path, std::vector<Event> &events)
+{
+    FILE *file = fopen(path, "rb");
+
+    if (!file)
+    {
+        return false;
+    }
+
+    char magic[sizeof(MAGIC)];
+    uint32_t event_size = 0;
+
+    bool valid = fread(magic, sizeof(magic), 1, file) == 1 && !memcmp(magic, MAGIC, sizeof(MAGIC)) &&
+                 fread(&event_size, sizeof(event_size), 1, file) == 1 && event_size == sizeof(Event);
+
+    if (valid)
+    {
+        Event event;
+        while (fread(&event, sizeof(event), 1, file) == 1)
+        {
+            events.push_back(event);
+        }
+    }
+
+    fclose(file);
+
+    return valid;
+}
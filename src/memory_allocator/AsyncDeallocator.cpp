@@ -0,0 +1,204 @@
+#include "memory_allocator/AsyncDeallocator.h"
+
+#include <algorithm>
+#include <iterator>
+
+thread_local AsyncDeallocator::ThreadBuffers AsyncDeallocator::thread_buffers;
+
+AsyncDeallocator::AsyncDeallocator(FreeBatch free_batch, size_t max_queued_batches)
+    : free_batch(std::move(free_batch)), max_queued_batches(max_queued_batches ? max_queued_batches : 1)
+{
+    worker = std::thread(&AsyncDeallocator::run, this);
+}
+
+AsyncDeallocator::~AsyncDeallocator()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        // the remaining partial buffers go to the worker regardless of the bound
+        auto claimed = std::remove_if(buffers.begin(), buffers.end(), [this](ThreadBuffer *buffer) {
+            // read first: once the owner is cleared, an exiting thread may free the buffer
+            Batch *batch = buffer->batch;
+            AsyncDeallocator *expected = this;
+
+            if (!buffer->owner.compare_exchange_strong(expected, 0))
+            {
+                return false;
+            }
+
+            if (batch->count)
+            {
+                queue.push_back(batch);
+            }
+            else
+            {
+                spares.push_back(batch);
+            }
+
+            return true;
+        });
+
+        buffers.erase(claimed, buffers.end());
+
+        // the rest were claimed by exiting threads, which detach them
+        progress.wait(lock, [this] { return buffers.empty(); });
+
+        stopping = true;
+    }
+
+    not_empty.notify_one();
+    worker.join();
+
+    for (Batch *batch : spares)
+    {
+        delete batch;
+    }
+}
+
+AsyncDeallocator::ThreadBuffer::~ThreadBuffer()
+{
+    release(*this);
+}
+
+void AsyncDeallocator::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (ThreadBuffer &buffer : thread_buffers.buffers)
+    {
+        if (buffer.owner.load(std::memory_order_relaxed) == this && buffer.batch->count)
+        {
+            enqueue(lock, buffer.batch);
+            buffer.batch = take_spare();
+        }
+    }
+
+    progress.wait(lock, [this] { return queue.empty() && !busy; });
+}
+
+void AsyncDeallocator::switch_buffer(void *mem)
+{
+    ThreadBuffer *begin = std::begin(thread_buffers.buffers), *end = std::end(thread_buffers.buffers);
+    ThreadBuffer *buffer = std::find_if(begin, end, [this](const ThreadBuffer &buffer) {
+        return buffer.owner.load(std::memory_order_relaxed) == this;
+    });
+
+    if (buffer == end)
+    {
+        buffer = std::find_if(begin, end, [](const ThreadBuffer &buffer) {
+            return !buffer.owner.load(std::memory_order_relaxed);
+        });
+    }
+
+    if (buffer == end)
+    {
+        buffer = &thread_buffers.buffers[thread_buffers.next_evicted++ % THREAD_BUFFERS];
+        release(*buffer);
+    }
+
+    if (buffer->owner.load(std::memory_order_relaxed) != this)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        buffers.push_back(buffer);
+        buffer->batch = take_spare();
+        buffer->owner.store(this, std::memory_order_relaxed);
+    }
+
+    thread_buffers.current = buffer;
+
+    deallocate(mem);
+}
+
+void AsyncDeallocator::release(ThreadBuffer &buffer)
+{
+    AsyncDeallocator *owner = buffer.owner.load(std::memory_order_relaxed);
+
+    // the owner cannot finish destroying itself until the claimed buffer is detached
+    if (owner && buffer.owner.compare_exchange_strong(owner, 0))
+    {
+        owner->detach(buffer);
+    }
+}
+
+void AsyncDeallocator::detach(ThreadBuffer &buffer)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (buffer.batch->count)
+    {
+        enqueue(lock, buffer.batch);
+    }
+    else
+    {
+        spares.push_back(buffer.batch);
+    }
+
+    buffers.erase(std::find(buffers.begin(), buffers.end(), &buffer));
+
+    buffer.batch = 0;
+
+    // the destructor may be waiting for it
+    progress.notify_all();
+}
+
+void AsyncDeallocator::submit(ThreadBuffer &buffer)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    enqueue(lock, buffer.batch);
+    buffer.batch = take_spare();
+}
+
+void AsyncDeallocator::enqueue(std::unique_lock<std::mutex> &lock, Batch *batch)
+{
+    progress.wait(lock, [this] { return queue.size() < max_queued_batches; });
+
+    queue.push_back(batch);
+    not_empty.notify_one();
+}
+
+AsyncDeallocator::Batch *AsyncDeallocator::take_spare()
+{
+    if (spares.empty())
+    {
+        return new Batch;
+    }
+
+    Batch *batch = spares.back();
+    spares.pop_back();
+
+    return batch;
+}
+
+void AsyncDeallocator::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true)
+    {
+        not_empty.wait(lock, [this] { return queue.size() || stopping; });
+
+        if (queue.empty())
+        {
+            return;
+        }
+
+        Batch *batch = queue.front();
+        queue.pop_front();
+        busy = true;
+
+        lock.unlock();
+
+        free_batch(batch->mem, batch->count);
+        batch->count = 0;
+
+        lock.lock();
+
+        spares.push_back(batch);
+        busy = false;
+
+        progress.notify_all();
+    }
+}
@@ -1,131 +1,336 @@
 #include "memory_allocator/BlockAllocator.h"
 
 #include <cassert>
+#include <cstdio>
 #include <cstdlib>
-#include <new>
+#include <cstring>
 #include <stdexcept>
 
+#include "memory_allocator/AllocationSampler.h"
+#include "memory_allocator/AllocationTrace.h"
 #include "memory_allocator/Debug.h"
+#include "memory_allocator/HeapDump.h"
+#include "memory_allocator/MemoryBudget.h"
 
-// Header
-size_t BlockAllocator::Header::get_size() const
+#ifdef LATENCY_HISTOGRAMS
+#define MEASURE_LATENCY(OPERATION) LatencyTimer latency_timer(latency.OPERATION, LatencyStats::get_thread().OPERATION)
+#else
+#define MEASURE_LATENCY(OPERATION)
+#endif
+
+#ifdef __linux__
+#define BLOCK_ALLOCATOR_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BLOCK_ALLOCATOR_AVX2
+#include <immintrin.h>
+#endif
+
+// Free bitmap
+static constexpr size_t WORD_BITS = 64;
+
+static size_t get_bitmap_word_count(size_t bit_count)
+{
+    return (bit_count + WORD_BITS - 1) / WORD_BITS;
+}
+
+// moves bits [from, end) up by count (< 64); bits [from, from + count) are left for the caller to set
+static void shift_bits_up(uint64_t *words, size_t from, size_t end, size_t count)
 {
-    return size_and_free_flag & size_mask;
+    size_t first = from / WORD_BITS, last = (end + count - 1) / WORD_BITS;
+
+    for (size_t w = last; w > first; --w)
+    {
+        words[w] = (words[w] << count) | (words[w - 1] >> (WORD_BITS - count));
+    }
+
+    uint64_t keep_mask = (uint64_t(1) << (from % WORD_BITS)) - 1;
+    words[first] = (words[first] & keep_mask) | ((words[first] << count) & ~keep_mask);
 }
 
-bool BlockAllocator::Header::is_free() const
+// moves bits [at + 1, end) down by one, overwriting bit at
+static void shift_bits_down(uint64_t *words, size_t at, size_t end)
 {
-    return size_and_free_flag & free_mask;
+    size_t first = at / WORD_BITS, last = (end - 1) / WORD_BITS;
+
+    uint64_t keep_mask = (uint64_t(1) << (at % WORD_BITS)) - 1;
+    uint64_t carry = first < last ? words[first + 1] << (WORD_BITS - 1) : 0;
+    words[first] = (words[first] & keep_mask) | (((words[first] >> 1) | carry) & ~keep_mask);
+
+    for (size_t w = first + 1; w <= last; ++w)
+    {
+        carry = w < last ? words[w + 1] << (WORD_BITS - 1) : 0;
+        words[w] = (words[w] >> 1) | carry;
+    }
 }
 
-void BlockAllocator::Header::set_free(bool free)
+// First-fit candidate search: starting at i, skips blocks that are in use or smaller than size, adding their sizes
+// to summed_offset. Returns the index of the first candidate, or end.
+template <typename Word>
+static size_t skip_unfit_blocks_scalar(const Word *sizes, const uint64_t *free_bits, size_t i, size_t end, size_t size,
+                                       size_t &summed_offset)
 {
-    size_and_free_flag = free ? size_and_free_flag | free_mask : size_and_free_flag & size_mask;
+    for (; i < end; ++i)
+    {
+        bool free = free_bits[i / WORD_BITS] >> (i % WORD_BITS) & 1;
+
+        if (free && sizes[i] >= size)
+        {
+            break;
+        }
+
+        summed_offset += sizes[i];
+    }
+
+    return i;
 }
 
-void BlockAllocator::Header::reset()
+#ifdef BLOCK_ALLOCATOR_AVX2
+// sets bit n of the result for each of the 4 or 8 lanes whose block size is >= size
+__attribute__((target("avx2"))) static unsigned get_fit_mask(__m256i block_sizes, size_t size, uint64_t)
 {
-    size_and_free_flag = free_mask;
+    // block sizes never reach the sign bit, so a signed compare against size - 1 is a >= size test
+    __m256i min_size = _mm256_set1_epi64x(static_cast<long long>(size) - 1);
+
+    return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(block_sizes, min_size)));
 }
 
-void BlockAllocator::Header::increment_size(size_t diff)
+__attribute__((target("avx2"))) static unsigned get_fit_mask(__m256i block_sizes, size_t size, uint32_t)
 {
-    size_and_free_flag += diff;
+    __m256i min_size = _mm256_set1_epi32(static_cast<uint32_t>(size));
+    __m256i fits = _mm256_cmpeq_epi32(_mm256_max_epu32(block_sizes, min_size), block_sizes);
+
+    return _mm256_movemask_ps(_mm256_castsi256_ps(fits));
 }
 
-bool BlockAllocator::Header::is_empty()
+// widens to 64-bit lanes so the running offset cannot overflow
+__attribute__((target("avx2"))) static __m256i add_block_sizes(__m256i sum, __m256i block_sizes, uint64_t)
 {
-    return size_and_free_flag == free_mask;
+    return _mm256_add_epi64(sum, block_sizes);
 }
 
-// Allocator
-BlockAllocator::Header &BlockAllocator::Header::operator+=(BlockAllocator::Header &other)
+__attribute__((target("avx2"))) static __m256i add_block_sizes(__m256i sum, __m256i block_sizes, uint32_t)
 {
-#ifdef BUILD_TESTS
-    assert(this != &other && "BlockAllocator::Header::operator+= expects 'this' != 'other'");
-    assert(this->is_free() && "BlockAllocator::Header::operator+= expects 'this' to be flagged free");
-    assert(other.is_free() && "BlockAllocator::Header::operator+= expects 'other' to be flagged free");
+    sum = _mm256_add_epi64(sum, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(block_sizes)));
+
+    return _mm256_add_epi64(sum, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(block_sizes, 1)));
+}
+
+template <typename Word>
+__attribute__((target("avx2"))) static size_t skip_unfit_blocks_avx2(const Word *sizes, const uint64_t *free_bits,
+                                                                      size_t i, size_t end, size_t size,
+                                                                      size_t &summed_offset)
+{
+    constexpr size_t lanes = sizeof(__m256i) / sizeof(Word);
+
+    // larger than any block can be
+    if (size > Word(~Word(0)))
+    {
+        return skip_unfit_blocks_scalar(sizes, free_bits, i, end, size, summed_offset);
+    }
+
+    // scalar up to a multiple of the lane count, so vector groups never straddle a bitmap word
+    size_t aligned_end = (i + lanes - 1) & ~(lanes - 1);
+    aligned_end = aligned_end < end ? aligned_end : end;
+
+    i = skip_unfit_blocks_scalar(sizes, free_bits, i, aligned_end, size, summed_offset);
+
+    if (i < aligned_end)
+    {
+        return i;
+    }
+
+    __m256i skipped = _mm256_setzero_si256();
+
+    for (; i + lanes <= end; i += lanes)
+    {
+        __m256i block_sizes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(sizes + i));
+
+        unsigned fits = get_fit_mask(block_sizes, size, Word());
+        unsigned free = free_bits[i / WORD_BITS] >> (i % WORD_BITS) & ((1u << lanes) - 1);
+
+        if (fits & free)
+        {
+            break;
+        }
+
+        skipped = add_block_sizes(skipped, block_sizes, Word());
+    }
+
+    __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(skipped), _mm256_extracti128_si256(skipped, 1));
+    summed_offset += _mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1);
+
+    return skip_unfit_blocks_scalar(sizes, free_bits, i, end, size, summed_offset);
+}
+#endif
+
+template <typename Word>
+static size_t skip_unfit_blocks(const Word *sizes, const uint64_t *free_bits, size_t i, size_t end, size_t size,
+                                size_t &summed_offset)
+{
+#ifdef BLOCK_ALLOCATOR_AVX2
+    static const bool has_avx2 = [] {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }();
+
+    if (has_avx2)
+    {
+        return skip_unfit_blocks_avx2(sizes, free_bits, i, end, size, summed_offset);
+    }
 #endif
-    size_and_free_flag += other.get_size();
-    other.reset();
 
-    return *this;
+    return skip_unfit_blocks_scalar(sizes, free_bits, i, end, size, summed_offset);
+}
+
+// the size class of a free block, floor(log2(units))
+static size_t get_size_class(size_t units)
+{
+    return WORD_BITS - 1 - __builtin_clzll(units);
 }
 
-BlockAllocator::BlockAllocator(size_t memory_size, size_t max_block_count)
+// Allocator
+template <typename Word, size_t MinAlignment>
+BasicBlockAllocator<Word, MinAlignment>::BasicBlockAllocator(size_t memory_size, size_t max_block_count)
 {
     init(memory_size, max_block_count);
 }
 
-void BlockAllocator::init(size_t memory_size, size_t max_block_count)
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::init(size_t memory_size, size_t max_block_count)
+{
+    init(malloc(get_buffer_size(memory_size, max_block_count)), memory_size, max_block_count);
+
+    external_memory = false;
+}
+
+template <typename Word, size_t MinAlignment>
+BasicBlockAllocator<Word, MinAlignment>::BasicBlockAllocator(void *buffer, size_t memory_size, size_t max_block_count)
+{
+    init(buffer, memory_size, max_block_count);
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::init(void *buffer, size_t memory_size, size_t max_block_count)
 {
     assert(max_block_count && "max_block_count must be non-zero");
+    assert(!(reinterpret_cast<uintptr_t>(buffer) % alignof(std::max_align_t)) && "buffer is not aligned");
 
-    if (memory)
-    {
-        free(memory);
-        memory = 0;
-    }
+    release_memory();
+
+    free_large_regions();
+
+    // the arena holds a whole number of units
+    memory_size -= memory_size % MinAlignment;
+
+    assert(memory_size / MinAlignment <= Word(~Word(0)) && "memory_size does not fit the header word type");
 
-    BlockAllocator::memory_size = memory_size;
+    BasicBlockAllocator::memory_size = memory_size;
     header_count = max_block_count;
 
-    memory = static_cast<char *>(malloc(memory_size + max_block_count * sizeof(Header)));
-    headers = reinterpret_cast<Header *>(memory + memory_size);
+    set_layout(static_cast<char *>(buffer));
+    external_memory = true;
 
-    for (size_t i = 0; i < max_block_count; ++i)
-    {
-        new (headers + i) Header();
-    }
+    memset(free_bits, ~0, get_bitmap_word_count(max_block_count) * sizeof(uint64_t));
 
-    headers[0].increment_size(memory_size);
+    sizes[0] = memory_size / MinAlignment;
 
     empty_headers_start = 1;
+
+    used_size = 0;
+    peak_used_size = 0;
+
+    clear_free_blocks();
+
+    tag_counters.clear();
+
+    remote_frees.store(0, std::memory_order_relaxed);
+
+    idle_ranges.clear();
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::rebase(void *buffer)
+{
+    set_layout(static_cast<char *>(buffer));
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::set_layout(char *buffer)
+{
+    size_t bitmap_offset = (memory_size + alignof(uint64_t) - 1) & ~(alignof(uint64_t) - 1);
+
+    memory = buffer;
+    free_bits = reinterpret_cast<uint64_t *>(memory + bitmap_offset);
+    sizes = reinterpret_cast<Word *>(free_bits + get_bitmap_word_count(header_count));
+    tags = reinterpret_cast<AllocationTag *>(sizes + header_count);
 }
 
-BlockAllocator::~BlockAllocator()
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::release_memory()
 {
-    if (memory)
+    if (memory && !external_memory)
     {
         free(memory);
-        memory = 0;
     }
+
+    memory = 0;
 }
 
-BlockAllocator::Header *BlockAllocator::get_free_header(size_t i)
+template <typename Word, size_t MinAlignment>
+BasicBlockAllocator<Word, MinAlignment>::~BasicBlockAllocator()
 {
-    if (i < empty_headers_start && headers[i].is_free())
-    {
-        return headers + i;
-    }
+    release_memory();
 
-    return 0;
+    free_large_regions();
+}
+
+template <typename Word, size_t MinAlignment>
+bool BasicBlockAllocator<Word, MinAlignment>::is_free(size_t i) const
+{
+    return free_bits[i / WORD_BITS] >> (i % WORD_BITS) & 1;
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::set_free(size_t i, bool free)
+{
+    uint64_t bit = uint64_t(1) << (i % WORD_BITS);
+
+    free_bits[i / WORD_BITS] = free ? free_bits[i / WORD_BITS] | bit : free_bits[i / WORD_BITS] & ~bit;
+}
+
+template <typename Word, size_t MinAlignment>
+bool BasicBlockAllocator<Word, MinAlignment>::is_free_block(size_t i) const
+{
+    return i < empty_headers_start && is_free(i);
 }
 
-bool BlockAllocator::shift_memory(size_t &i, size_t left, size_t right)
+template <typename Word, size_t MinAlignment>
+bool BasicBlockAllocator<Word, MinAlignment>::shift_memory(size_t &i, size_t left, size_t right)
 {
     bool do_shift_left = !!left, do_shift_right = !!right;
 
-    if (do_shift_left)
+    if (do_shift_left && is_free_block(i - 1))
     {
-        Header *dest_left = get_free_header(i - 1);
-        if (dest_left)
-        {
-            dest_left->increment_size(left);
-            headers[i].increment_size(-left);
-            do_shift_left = 0;
-        }
+        remove_free_block(i - 1);
+        sizes[i - 1] += left;
+        sizes[i] -= left;
+        do_shift_left = 0;
+
+        add_free_block(i - 1);
     }
 
-    if (do_shift_right)
+    if (do_shift_right && is_free_block(i + 1))
     {
-        Header *dest_right = get_free_header(i + 1);
-        if (dest_right)
-        {
-            dest_right->increment_size(right);
-            headers[i].increment_size(-right);
-            do_shift_right = 0;
-        }
+        remove_free_block(i + 1);
+        sizes[i + 1] += right;
+        sizes[i] -= right;
+        do_shift_right = 0;
+
+        add_free_block(i + 1);
     }
 
     size_t insert_count = do_shift_left + do_shift_right;
@@ -140,48 +345,112 @@ bool BlockAllocator::shift_memory(size_t &i, size_t left, size_t right)
 
         size_t dest_index = i + insert_count;
 
-        memmove(headers + dest_index, headers + i, sizeof(Header) * (empty_headers_start - i));
+        insert_headers(i, insert_count);
 
         i = dest_index - do_shift_right;
 
         if (do_shift_right)
         {
-            headers[i].reset();
-            headers[i].increment_size(headers[dest_index].get_size() - right);
+            sizes[i] = sizes[dest_index] - right;
+            set_free(i, true);
 
-            headers[dest_index].reset();
-            headers[dest_index].increment_size(right);
-
-            ++empty_headers_start;
+            sizes[dest_index] = right;
+            add_free_block(dest_index);
         }
 
         if (do_shift_left)
         {
-            headers[i].increment_size(-left);
-
-            headers[i - 1].reset();
-            headers[i - 1].increment_size(left);
+            sizes[i] -= left;
 
-            ++empty_headers_start;
+            sizes[i - 1] = left;
+            set_free(i - 1, true);
+            add_free_block(i - 1);
         }
     }
 
     return true;
 }
 
-void *BlockAllocator::allocate(size_t size, size_t alignment)
+template <typename Word, size_t MinAlignment>
+void *BasicBlockAllocator<Word, MinAlignment>::allocate(size_t size, size_t alignment)
+{
+    MEASURE_LATENCY(allocate);
+
+    if (remote_frees.load(std::memory_order_relaxed))
+    {
+        drain_remote_frees();
+    }
+
+    size = size < min_block_size ? min_block_size : size;
+
+    size_t units = (size + MinAlignment - 1) / MinAlignment;
+    size_t alignment_units = alignment > MinAlignment ? alignment / MinAlignment : 1;
+
+    bool large = large_allocation_threshold && size >= large_allocation_threshold;
+
+    // the budget counts whole blocks, like get_stats(); its callbacks may free blocks, so it goes first
+    size_t charge = large ? size : units * MinAlignment;
+    void *mem = 0;
+
+    if (!budget || budget->reserve(charge))
+    {
+        if (large)
+        {
+            mem = allocate_large(size, alignment);
+        }
+        else
+        {
+            mem = allocate_first_fit(units, alignment_units);
+
+            if (!mem && coalesce_policy == CoalescePolicy::Deferred && coalesce())
+            {
+                mem = allocate_first_fit(units, alignment_units);
+            }
+        }
+
+        if (!mem && budget)
+        {
+            budget->release(charge);
+        }
+    }
+
+    if (trace)
+    {
+        trace->record_allocate(mem, size, alignment);
+    }
+
+    if (sampler && mem)
+    {
+        sampler->record_allocate(mem, size);
+    }
+
+    return mem;
+}
+
+template <typename Word, size_t MinAlignment>
+void *BasicBlockAllocator<Word, MinAlignment>::allocate_first_fit(size_t units, size_t alignment_units)
 {
     // find first fitting block
     size_t diff = INVALID_INT, block_index = 0, block_offset = 0, padding = 0;
     {
+        // padding aligns the address, and the arena itself may be aligned to less than the request, e.g. a page
+        size_t base_units = reinterpret_cast<uintptr_t>(memory) / MinAlignment;
         size_t summed_offset = 0;
         for (size_t i = 0; i < empty_headers_start; ++i)
         {
-            size_t block_size = headers[i].get_size();
-            padding = (alignment - (summed_offset % alignment)) % alignment;
-            size_t aligned_size = padding + size;
+            // every block skipped here is in use or too small even without padding
+            i = skip_unfit_blocks(sizes, free_bits, i, empty_headers_start, units, summed_offset);
 
-            if (block_size >= aligned_size && headers[i].is_free())
+            if (i == empty_headers_start)
+            {
+                break;
+            }
+
+            size_t block_size = sizes[i];
+            padding = (alignment_units - ((base_units + summed_offset) % alignment_units)) % alignment_units;
+            size_t aligned_size = padding + units;
+
+            if (block_size >= aligned_size)
             {
                 diff = block_size - aligned_size;
                 block_index = i;
@@ -197,125 +466,924 @@ void *BlockAllocator::allocate(size_t size, size_t alignment)
     void *mem = 0;
     if (diff != INVALID_INT)
     {
+        // the whole block leaves the free blocks, and shift_memory adds back what is left of it
+        remove_free_block(block_index);
+
         if (!(padding || diff) || shift_memory(block_index, padding, diff))
         {
-            headers[block_index].set_free(false);
-            mem = static_cast<void *>(memory + block_offset + padding);
+            set_free(block_index, false);
+            mem = static_cast<void *>(memory + (block_offset + padding) * MinAlignment);
+
+            used_size += sizes[block_index];
+            peak_used_size = used_size > peak_used_size ? used_size : peak_used_size;
+
+            tags[block_index] = AllocationTagScope::get_current();
+            tag_counters.add(tags[block_index], sizes[block_index] * MinAlignment);
+
+            size_t begin = (block_offset + padding) * MinAlignment, end = begin + sizes[block_index] * MinAlignment;
+            reused_begin = begin < reused_begin ? begin : reused_begin;
+            reused_end = end > reused_end ? end : reused_end;
+        }
+        else
+        {
+            add_free_block(block_index);
         }
+
+        resolve_largest_free();
     }
 
     return mem;
 }
 
-void BlockAllocator::deallocate(void *mem)
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::deallocate(void *mem)
 {
-    size_t offset = static_cast<char *>(mem) - memory;
+    if (owner_thread != std::thread::id() && owner_thread != std::this_thread::get_id())
+    {
+        return push_remote_free(mem);
+    }
 
-    assert(offset < memory_size && "invalid memory address");
+    MEASURE_LATENCY(deallocate);
 
-    size_t summed_offset = 0;
+    if (trace)
+    {
+        trace->record_deallocate(mem);
+    }
 
-    for (size_t i = 0; i < empty_headers_start; ++i)
+    if (sampler)
     {
-        if (summed_offset == offset)
-        {
-            headers[i].set_free(true);
+        sampler->record_deallocate(mem);
+    }
 
-            coalesce_adjacent_blocks(i);
+    if (!is_in_arena(mem))
+    {
+        return deallocate_large(mem);
+    }
 
-            return;
-        }
+    size_t i = find_block(mem);
 
-        summed_offset += headers[i].get_size();
+    if (i == INVALID_INT)
+    {
+        throw std::runtime_error("BlockAllocator::deallocate failed");
     }
 
-    throw std::runtime_error("BlockAllocator::deallocate failed");
-}
+    assert(!is_free(i) && "BlockAllocator::deallocate: block is already free (double free, or a stale pointer from "
+                          "before reset())");
 
-void BlockAllocator::shift_empty_header(size_t i)
-{
-    size_t src_index = i + 1;
+    set_free(i, true);
+    add_free_block(i);
+    used_size -= sizes[i];
 
-    memmove(headers + i, headers + src_index, sizeof(Header) * (empty_headers_start - src_index));
-    // memcpy(headers + i, headers + src_index, sizeof(Header) * (empty_headers_start - src_index));
+    tag_counters.remove(tags[i], sizes[i] * MinAlignment);
 
-    --empty_headers_start;
+    if (budget)
+    {
+        budget->release(sizes[i] * MinAlignment);
+    }
 
-    headers[empty_headers_start].reset();
+    if (coalesce_policy == CoalescePolicy::Immediate)
+    {
+        coalesce_adjacent_blocks(i);
+    }
+
+    resolve_largest_free();
 }
 
-void BlockAllocator::coalesce_adjacent_blocks(size_t i)
+template <typename Word, size_t MinAlignment>
+void *BasicBlockAllocator<Word, MinAlignment>::reallocate(void *mem, size_t size, size_t alignment)
 {
-    size_t adjacent_index = i + 1;
-    if (adjacent_index < empty_headers_start && headers[adjacent_index].is_free())
+    if (!mem)
     {
-        headers[i] += headers[adjacent_index];
-
-        shift_empty_header(adjacent_index);
+        return allocate(size, alignment);
     }
 
-    adjacent_index -= 2;
-    if (i && headers[adjacent_index].is_free())
+    if (!is_in_arena(mem))
     {
-        headers[adjacent_index] += headers[i];
+        void *resized = reallocate_large(mem, size);
+
+        if (resized)
+        {
+            if (trace)
+            {
+                trace->record_deallocate(mem);
+                trace->record_allocate(resized, size, alignment);
+            }
 
-        shift_empty_header(i);
+            if (sampler)
+            {
+                sampler->record_deallocate(mem);
+                sampler->record_allocate(resized, size);
+            }
+        }
+
+        return resized;
     }
-}
 
-#ifdef BUILD_TESTS
-#include <iostream>
+    size_t i = find_block(mem);
 
-void BlockAllocator::log_headers() const
-{
-    for (size_t i = 0; i < header_count;)
+    if (i == INVALID_INT)
     {
-        for (size_t j = 0; j < 10 && header_count; ++j)
-        {
-            std::cout << headers[i].is_free() << ":" << headers[i].get_size() << " ";
-            ++i;
-        }
-        std::cout << "\n";
+        throw std::runtime_error("BlockAllocator::reallocate failed");
+    }
+
+    size_t old_size = sizes[i] * MinAlignment;
+    void *resized = allocate(size, alignment);
+
+    if (resized)
+    {
+        memcpy(resized, mem, old_size < size ? old_size : size);
+        deallocate(mem);
     }
+
+    return resized;
 }
 
-size_t BlockAllocator::count_active_headers() const
+template <typename Word, size_t MinAlignment>
+bool BasicBlockAllocator<Word, MinAlignment>::owns(const void *mem) const
 {
-    size_t count = 0;
-    for (size_t i = 0; i < header_count; ++i)
+    if (is_in_arena(mem))
+    {
+        return true;
+    }
+
+    for (LargeRegion *region = large_regions; region; region = region->next)
     {
-        if (!headers[i].is_empty())
+        if (region + 1 == mem)
         {
-            count++;
+            return true;
         }
     }
-    return count;
+
+    return false;
 }
 
-size_t BlockAllocator::count_free_blocks() const
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::set_large_allocation_threshold(size_t threshold)
 {
-    size_t count = 0;
-    for (size_t i = 0; i < header_count; ++i)
+#ifdef BLOCK_ALLOCATOR_MMAP
+    large_allocation_threshold = threshold;
+#endif
+}
+
+template <typename Word, size_t MinAlignment>
+bool BasicBlockAllocator<Word, MinAlignment>::is_in_arena(const void *mem) const
+{
+    return mem >= memory && mem < memory + memory_size;
+}
+
+template <typename Word, size_t MinAlignment>
+size_t BasicBlockAllocator<Word, MinAlignment>::find_block(const void *mem) const
+{
+    size_t offset = static_cast<const char *>(mem) - memory;
+
+    // an address inside a unit never matches a block start
+    if (offset % MinAlignment)
+    {
+        return INVALID_INT;
+    }
+
+    offset /= MinAlignment;
+
+    size_t summed_offset = 0;
+
+    for (size_t i = 0; i < empty_headers_start; ++i)
     {
-        if (headers[i].is_free() && headers[i].get_size())
+        if (summed_offset == offset)
         {
-            count++;
+            return i;
         }
+
+        summed_offset += sizes[i];
     }
-    return count;
+
+    return INVALID_INT;
 }
 
-size_t BlockAllocator::get_largest_free_block() const
+#ifdef BLOCK_ALLOCATOR_MMAP
+static size_t get_page_size()
 {
-    size_t largest = 0;
+    static size_t page_size = sysconf(_SC_PAGESIZE);
+
+    return page_size;
+}
 
-    for (size_t i = 0; i < header_count; ++i)
+template <typename Word, size_t MinAlignment>
+void *BasicBlockAllocator<Word, MinAlignment>::allocate_large(size_t size, size_t alignment)
+{
+    size_t page_size = get_page_size();
+
+    // mappings are page aligned, so the region header is padded up to the requested alignment
+    alignment = alignment < alignof(LargeRegion) ? alignof(LargeRegion) : alignment;
+
+    // above a page, alignment bytes of slack are mapped and what the aligned region does not cover is unmapped
+    size_t slack = alignment > page_size ? alignment : 0;
+    size_t offset = (sizeof(LargeRegion) + alignment - 1) & ~(alignment - 1);
+
+    if (size > ~size_t(0) - offset - slack - page_size)
     {
-        size_t size = headers[i].get_size();
-        if (headers[i].is_free() && size)
-            largest = largest > size ? largest : size;
+        return 0;
+    }
+
+    size_t mapped = (((slack ? sizeof(LargeRegion) : offset) + size + page_size - 1) & ~(page_size - 1)) + slack;
+
+    void *raw = mmap(0, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (raw == MAP_FAILED)
+    {
+        return 0;
+    }
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+    uintptr_t mem = (start + sizeof(LargeRegion) + alignment - 1) & ~(alignment - 1);
+    uintptr_t base = (mem - sizeof(LargeRegion)) & ~(page_size - 1);
+    uintptr_t end = (mem + size + page_size - 1) & ~(page_size - 1);
+
+    if (base > start)
+    {
+        munmap(raw, base - start);
+    }
+
+    if (start + mapped > end)
+    {
+        munmap(reinterpret_cast<void *>(end), start + mapped - end);
     }
 
-    return largest;
+    size_t region_size = end - base;
+    LargeRegion *region = reinterpret_cast<LargeRegion *>(mem) - 1;
+
+    region->base = reinterpret_cast<char *>(base);
+    region->mapped_size = region_size;
+    region->size = size;
+    region->tag = AllocationTagScope::get_current();
+
+    link_large_region(region);
+
+    mapped_size += region_size;
+    tag_counters.add(region->tag, size);
+
+    return region + 1;
 }
-#endif
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::deallocate_large(void *mem)
+{
+    if (!owns(mem))
+    {
+        throw std::runtime_error("BlockAllocator::deallocate failed");
+    }
+
+    LargeRegion *region = static_cast<LargeRegion *>(mem) - 1;
+
+    unlink_large_region(region);
+
+    mapped_size -= region->mapped_size;
+    tag_counters.remove(region->tag, region->size);
+
+    if (budget)
+    {
+        budget->release(region->size);
+    }
+
+    munmap(region->base, region->mapped_size);
+}
+
+template <typename Word, size_t MinAlignment>
+void *BasicBlockAllocator<Word, MinAlignment>::reallocate_large(void *mem, size_t size)
+{
+    if (!owns(mem))
+    {
+        throw std::runtime_error("BlockAllocator::reallocate failed");
+    }
+
+    LargeRegion *region = static_cast<LargeRegion *>(mem) - 1;
+
+    size_t page_size = get_page_size();
+    size_t offset = static_cast<char *>(mem) - region->base;
+    size_t region_size = (offset + size + page_size - 1) & ~(page_size - 1);
+
+    size_t growth = size > region->size ? size - region->size : 0;
+
+    if (budget && growth && !budget->reserve(growth))
+    {
+        return 0;
+    }
+
+    if (region_size != region->mapped_size)
+    {
+        // the kernel moves the pages, if it must, by remapping them rather than copying
+        void *base = mremap(region->base, region->mapped_size, region_size, MREMAP_MAYMOVE);
+
+        if (base == MAP_FAILED)
+        {
+            if (budget)
+            {
+                budget->release(growth);
+            }
+
+            return 0;
+        }
+
+        region = reinterpret_cast<LargeRegion *>(static_cast<char *>(base) + offset) - 1;
+
+        mapped_size += region_size - region->mapped_size;
+        region->base = static_cast<char *>(base);
+        region->mapped_size = region_size;
+
+        // the neighbours still point at the old address
+        (region->previous ? region->previous->next : large_regions) = region;
+        if (region->next)
+        {
+            region->next->previous = region;
+        }
+    }
+
+    if (budget && !growth)
+    {
+        budget->release(region->size - size);
+    }
+
+    tag_counters.remove(region->tag, region->size);
+    tag_counters.add(region->tag, size);
+
+    region->size = size;
+
+    return region + 1;
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::free_large_regions()
+{
+    while (large_regions)
+    {
+        LargeRegion *region = large_regions;
+        large_regions = region->next;
+
+        munmap(region->base, region->mapped_size);
+    }
+
+    mapped_size = 0;
+}
+#else
+template <typename Word, size_t MinAlignment>
+void *BasicBlockAllocator<Word, MinAlignment>::allocate_large(size_t size, size_t alignment)
+{
+    return 0;
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::deallocate_large(void *mem)
+{
+    throw std::runtime_error("BlockAllocator::deallocate failed");
+}
+
+template <typename Word, size_t MinAlignment>
+void *BasicBlockAllocator<Word, MinAlignment>::reallocate_large(void *mem, size_t size)
+{
+    throw std::runtime_error("BlockAllocator::reallocate failed");
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::free_large_regions()
+{
+}
+#endif
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::link_large_region(LargeRegion *region)
+{
+    region->previous = 0;
+    region->next = large_regions;
+
+    if (large_regions)
+    {
+        large_regions->previous = region;
+    }
+
+    large_regions = region;
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::unlink_large_region(LargeRegion *region)
+{
+    (region->previous ? region->previous->next : large_regions) = region->next;
+
+    if (region->next)
+    {
+        region->next->previous = region->previous;
+    }
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::set_coalesce_policy(CoalescePolicy policy)
+{
+    coalesce_policy = policy;
+}
+
+template <typename Word, size_t MinAlignment>
+size_t BasicBlockAllocator<Word, MinAlignment>::coalesce(size_t max_merges)
+{
+    MEASURE_LATENCY(coalesce);
+
+    if (!empty_headers_start)
+    {
+        return 0;
+    }
+
+    size_t merges = 0, last = 0, i = 1;
+
+    for (; i < empty_headers_start && merges < max_merges; ++i)
+    {
+        if (is_free(last) && is_free(i))
+        {
+            remove_free_block(last);
+            remove_free_block(i);
+            sizes[last] += sizes[i];
+            ++merges;
+
+            add_free_block(last);
+        }
+        else
+        {
+            ++last;
+            sizes[last] = sizes[i];
+            tags[last] = tags[i];
+            set_free(last, is_free(i));
+        }
+    }
+
+    // budget exhausted: keep the rest of the list as is
+    for (; i < empty_headers_start; ++i)
+    {
+        ++last;
+        sizes[last] = sizes[i];
+        tags[last] = tags[i];
+        set_free(last, is_free(i));
+    }
+
+    empty_headers_start = last + 1;
+
+    resolve_largest_free();
+
+    return merges;
+}
+
+template <typename Word, size_t MinAlignment>
+size_t BasicBlockAllocator<Word, MinAlignment>::release_idle_memory(size_t idle_passes, size_t max_bytes)
+{
+#ifdef BLOCK_ALLOCATOR_MMAP
+    if (external_memory)
+    {
+        return 0;
+    }
+
+    size_t page_size = get_page_size(), released = 0, offset = 0, previous = 0;
+    std::vector<IdleRange> ranges;
+
+    for (size_t i = 0; i < empty_headers_start;)
+    {
+        if (!is_free(i))
+        {
+            offset += sizes[i++] * MinAlignment;
+            continue;
+        }
+
+        size_t size = 0;
+        for (; i < empty_headers_start && is_free(i); ++i)
+        {
+            size += sizes[i] * MinAlignment;
+        }
+
+        // the whole pages of the run
+        uintptr_t start = (reinterpret_cast<uintptr_t>(memory + offset) + page_size - 1) & ~(page_size - 1);
+        uintptr_t end = reinterpret_cast<uintptr_t>(memory + offset + size) & ~(page_size - 1);
+
+        if (start < end)
+        {
+            IdleRange range = {offset, size, 1, 0};
+
+            for (; previous < idle_ranges.size() && idle_ranges[previous].offset < offset; ++previous)
+            {
+            }
+
+            // the same bounds, and not allocated from since: a range refilled and freed back in between must be
+            // released again
+            bool reused = offset < reused_end && offset + size > reused_begin;
+
+            if (previous < idle_ranges.size() && idle_ranges[previous].offset == offset &&
+                idle_ranges[previous].size == size && !reused)
+            {
+                range.passes = idle_ranges[previous].passes + 1;
+                range.released_size = idle_ranges[previous].released_size;
+            }
+
+            size_t release_size = end - start - range.released_size;
+            release_size = release_size < max_bytes - released ? release_size : (max_bytes - released) & ~(page_size - 1);
+
+            if (range.passes > idle_passes && release_size)
+            {
+                end -= range.released_size;
+
+                if (!madvise(reinterpret_cast<void *>(end - release_size), release_size, MADV_DONTNEED))
+                {
+                    range.released_size += release_size;
+                    released += release_size;
+                }
+            }
+
+            ranges.push_back(range);
+        }
+
+        offset += size;
+    }
+
+    idle_ranges.swap(ranges);
+
+    reused_begin = INVALID_INT;
+    reused_end = 0;
+
+    return released;
+#else
+    return 0;
+#endif
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::reset()
+{
+    if (budget)
+    {
+        budget->release(used_size * MinAlignment);
+
+        for (LargeRegion *region = large_regions; region; region = region->next)
+        {
+            budget->release(region->size);
+        }
+    }
+
+    // headers past empty_headers_start are never read before being overwritten, so they are left stale
+    sizes[0] = memory_size / MinAlignment;
+    set_free(0, true);
+
+    empty_headers_start = 1;
+
+    used_size = 0;
+
+    clear_free_blocks();
+
+    tag_counters.clear();
+
+    free_large_regions();
+
+    // the queued blocks are freed with the rest
+    remote_frees.store(0, std::memory_order_relaxed);
+
+    // the arena may have been used in between
+    idle_ranges.clear();
+
+    ++epoch;
+}
+
+template <typename Word, size_t MinAlignment>
+size_t BasicBlockAllocator<Word, MinAlignment>::get_epoch() const
+{
+    return epoch;
+}
+
+template <typename Word, size_t MinAlignment>
+typename BasicBlockAllocator<Word, MinAlignment>::Handle BasicBlockAllocator<Word, MinAlignment>::allocate_handle(
+    size_t size, size_t alignment)
+{
+    return {allocate(size, alignment), epoch};
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::deallocate(Handle handle)
+{
+    deallocate(get(handle));
+}
+
+template <typename Word, size_t MinAlignment>
+typename BasicBlockAllocator<Word, MinAlignment>::Handle BasicBlockAllocator<Word, MinAlignment>::reallocate(
+    Handle handle, size_t size, size_t alignment)
+{
+    return {reallocate(get(handle), size, alignment), epoch};
+}
+
+template <typename Word, size_t MinAlignment>
+void *BasicBlockAllocator<Word, MinAlignment>::get(Handle handle) const
+{
+    assert(handle.epoch == epoch && "BlockAllocator: handle used after reset()");
+
+    return handle.mem;
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::set_trace(AllocationTrace *trace)
+{
+    BasicBlockAllocator::trace = trace;
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::set_sampler(AllocationSampler *sampler)
+{
+    BasicBlockAllocator::sampler = sampler;
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::set_budget(MemoryBudget *budget)
+{
+    assert(!used_size && !large_regions && "BlockAllocator::set_budget: blocks are in use");
+
+    BasicBlockAllocator::budget = budget;
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::set_owner_thread(std::thread::id owner)
+{
+    assert(!used_size && !large_regions && "BlockAllocator::set_owner_thread: blocks are in use");
+
+    owner_thread = owner;
+    min_block_size = owner == std::thread::id() ? 0 : sizeof(void *);
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::push_remote_free(void *mem)
+{
+    void *head = remote_frees.load(std::memory_order_relaxed);
+
+    // the block is dead, so its first bytes hold the link; blocks may be unaligned, hence memcpy
+    do
+    {
+        memcpy(mem, &head, sizeof(head));
+    } while (!remote_frees.compare_exchange_weak(head, mem, std::memory_order_release, std::memory_order_relaxed));
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::drain_remote_frees()
+{
+    void *mem = remote_frees.exchange(0, std::memory_order_acquire);
+
+    while (mem)
+    {
+        void *next;
+        memcpy(&next, mem, sizeof(next));
+
+        deallocate(mem);
+
+        mem = next;
+    }
+}
+
+template <typename Word, size_t MinAlignment>
+AllocatorStats BasicBlockAllocator<Word, MinAlignment>::get_stats() const
+{
+    AllocatorStats stats;
+
+    stats.capacity = memory_size;
+    stats.bytes_in_use = used_size * MinAlignment;
+    stats.free_bytes = memory_size - stats.bytes_in_use;
+    stats.largest_free_block = largest_free_size * MinAlignment;
+    stats.high_water_mark = peak_used_size * MinAlignment;
+    stats.mapped_bytes = mapped_size;
+    stats.headers_used = empty_headers_start;
+    stats.header_capacity = header_count;
+    stats.fragmentation = stats.free_bytes ? 1 - double(stats.largest_free_block) / stats.free_bytes : 0;
+
+    return stats;
+}
+
+template <typename Word, size_t MinAlignment>
+const TagCounters &BasicBlockAllocator<Word, MinAlignment>::get_tag_counters() const
+{
+    return tag_counters;
+}
+
+template <typename Word, size_t MinAlignment>
+bool BasicBlockAllocator<Word, MinAlignment>::dump(const char *path) const
+{
+    FILE *file = fopen(path, "w");
+
+    if (!file)
+    {
+        return false;
+    }
+
+    fprintf(file, "%s\narena,%zu,%zu,%zu\n", HeapDump::HEADER, memory_size, empty_headers_start, header_count);
+
+    size_t offset = 0;
+
+    for (size_t i = 0; i < empty_headers_start; ++i)
+    {
+        size_t size = sizes[i] * MinAlignment;
+
+        // empty free headers left behind by merges are not blocks
+        if (size || !is_free(i))
+        {
+            fprintf(file, "block,%zu,%zu,%s,%u\n", offset, size, is_free(i) ? "free" : "used",
+                    is_free(i) ? 0u : unsigned(tags[i]));
+        }
+
+        offset += size;
+    }
+
+    bool written = !ferror(file);
+
+    return !fclose(file) && written;
+}
+
+#ifdef LATENCY_HISTOGRAMS
+template <typename Word, size_t MinAlignment>
+const LatencyStats &BasicBlockAllocator<Word, MinAlignment>::get_latency() const
+{
+    return latency;
+}
+#endif
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::insert_headers(size_t i, size_t count)
+{
+    memmove(sizes + i + count, sizes + i, sizeof(Word) * (empty_headers_start - i));
+    memmove(tags + i + count, tags + i, sizeof(AllocationTag) * (empty_headers_start - i));
+    shift_bits_up(free_bits, i, empty_headers_start, count);
+
+    empty_headers_start += count;
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::erase_header(size_t i)
+{
+    size_t src_index = i + 1;
+
+    memmove(sizes + i, sizes + src_index, sizeof(Word) * (empty_headers_start - src_index));
+    memmove(tags + i, tags + src_index, sizeof(AllocationTag) * (empty_headers_start - src_index));
+    shift_bits_down(free_bits, i, empty_headers_start);
+
+    --empty_headers_start;
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::merge_blocks(size_t left)
+{
+#ifdef BUILD_TESTS
+    assert(is_free(left) && "BlockAllocator::merge_blocks expects the left block to be flagged free");
+    assert(is_free(left + 1) && "BlockAllocator::merge_blocks expects the right block to be flagged free");
+#endif
+    remove_free_block(left);
+    remove_free_block(left + 1);
+    sizes[left] += sizes[left + 1];
+
+    erase_header(left + 1);
+
+    add_free_block(left);
+}
+
+template <typename Word, size_t MinAlignment>
+size_t BasicBlockAllocator<Word, MinAlignment>::coalesce_adjacent_blocks(size_t i)
+{
+    if (is_free_block(i + 1))
+    {
+        merge_blocks(i);
+    }
+
+    if (i && is_free(i - 1))
+    {
+        merge_blocks(--i);
+    }
+
+    return i;
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::clear_free_blocks()
+{
+    memset(free_class_counts, 0, sizeof(free_class_counts));
+
+    largest_free_size = 0;
+    removed_largest_size = 0;
+
+    add_free_block(0);
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::add_free_block(size_t i)
+{
+    ++free_class_counts[get_size_class(sizes[i])];
+
+    largest_free_size = sizes[i] > largest_free_size ? sizes[i] : largest_free_size;
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::remove_free_block(size_t i)
+{
+    --free_class_counts[get_size_class(sizes[i])];
+
+    // another free block may be as large; resolve_largest_free finds out once the call is done
+    if (sizes[i] >= largest_free_size)
+    {
+        removed_largest_size = sizes[i] > removed_largest_size ? sizes[i] : removed_largest_size;
+        largest_free_size = 0;
+    }
+}
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::resolve_largest_free()
+{
+    if (!removed_largest_size)
+    {
+        return;
+    }
+
+    size_t top_class = WORD_BITS;
+    while (top_class && !free_class_counts[top_class - 1])
+    {
+        --top_class;
+    }
+
+    // every free block is at most the largest removed one, so a block added since that is as large is the largest; so
+    // is one that is alone in the top size class, e.g. what is left of a block split by allocate
+    bool exact = largest_free_size >= removed_largest_size || !top_class ||
+                 (free_class_counts[top_class - 1] == 1 && largest_free_size &&
+                  get_size_class(largest_free_size) == top_class - 1);
+
+    removed_largest_size = 0;
+
+    if (exact)
+    {
+        return;
+    }
+
+    largest_free_size = 0;
+
+    for (size_t i = 0; i < empty_headers_start; ++i)
+    {
+        if (is_free(i) && sizes[i] > largest_free_size)
+        {
+            largest_free_size = sizes[i];
+        }
+    }
+}
+
+#ifdef BUILD_TESTS
+#include <iostream>
+
+template <typename Word, size_t MinAlignment>
+void BasicBlockAllocator<Word, MinAlignment>::log_headers() const
+{
+    for (size_t i = 0; i < empty_headers_start;)
+    {
+        for (size_t j = 0; j < 10 && i < empty_headers_start; ++j)
+        {
+            std::cout << is_free(i) << ":" << sizes[i] * MinAlignment << " ";
+            ++i;
+        }
+        std::cout << "\n";
+    }
+}
+
+template <typename Word, size_t MinAlignment>
+size_t BasicBlockAllocator<Word, MinAlignment>::count_active_headers() const
+{
+    size_t count = 0;
+    for (size_t i = 0; i < empty_headers_start; ++i)
+    {
+        if (!is_free(i) || sizes[i])
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+template <typename Word, size_t MinAlignment>
+size_t BasicBlockAllocator<Word, MinAlignment>::count_free_blocks() const
+{
+    size_t count = 0;
+    for (size_t i = 0; i < empty_headers_start; ++i)
+    {
+        if (is_free(i) && sizes[i])
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+template <typename Word, size_t MinAlignment>
+size_t BasicBlockAllocator<Word, MinAlignment>::get_largest_free_block() const
+{
+    size_t largest = 0;
+
+    for (size_t i = 0; i < empty_headers_start; ++i)
+    {
+        size_t size = sizes[i];
+        if (is_free(i) && size)
+            largest = largest > size ? largest : size;
+    }
+
+    return largest * MinAlignment;
+}
+#endif
+
+template class BasicBlockAllocator<uint64_t, 1>;
+template class BasicBlockAllocator<uint32_t, 1>;
+template class BasicBlockAllocator<uint32_t, alignof(std::max_align_t)>;
@@ -1,6 +1,13 @@
 #include "memory_allocator/Chunk.h"
 #include "memory_allocator/Debug.h"
 
+#include <cstdint>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #ifndef MIN_SEGMENT_SIZE
 #define MIN_SEGMENT_SIZE 32
 #endif
@@ -15,27 +22,46 @@ Chunk::Chunk(size_t size)
 
 void Chunk::init(size_t size)
 {
-    assert("Chunk size cannot be less than " STRING(MIN_SEGMENT_SIZE) " bytes" && size >= MIN_SEGMENT_SIZE);
+    init(malloc(get_buffer_size(size)), size);
 
-    memory_size = MIN_SEGMENT_SIZE;
-    do
-    {
-        memory_size *= 2;
-    } while (memory_size < size);
+    external_memory = false;
+}
+
+Chunk::Chunk(void *buffer, size_t size)
+{
+    init(buffer, size);
+}
 
-    set_bitmap_size();
+void Chunk::init(void *buffer, size_t size)
+{
+    set_sizes(size);
 
-    memory = static_cast<char *>(malloc(memory_size + bitmap_size));
+    memory = static_cast<char *>(buffer);
+    external_memory = true;
 
     bitmap = memory + memory_size;
     memset(bitmap, ~0, bitmap_size);
 
+    size_t level = 0;
+    for (size_t segments_count = max_segments_count; segments_count; segments_count /= 2)
+    {
+        free_segment_counts[level++] = segments_count;
+    }
+
     free_bytes_count = memory_size;
 }
 
+size_t Chunk::get_buffer_size(size_t size)
+{
+    Chunk chunk;
+    chunk.set_sizes(size);
+
+    return chunk.memory_size + chunk.bitmap_size;
+}
+
 Chunk::~Chunk()
 {
-    if (memory)
+    if (memory && !external_memory)
     {
         ::free(memory);
     }
@@ -48,7 +74,7 @@ void *Chunk::allocate(size_t bytes_requested)
         return 0;
     }
 
-    size_t segment_size = MIN_SEGMENT_SIZE, bitmap_index = 0, segments_count = max_segments_count;
+    size_t segment_size = MIN_SEGMENT_SIZE, bitmap_index = 0, segments_count = max_segments_count, level = 0;
 
     while (segment_size < bytes_requested)
     {
@@ -57,6 +83,12 @@ void *Chunk::allocate(size_t bytes_requested)
         segments_count /= 2;
 
         segment_size *= 2;
+        ++level;
+    }
+
+    if (!free_segment_counts[level])
+    {
+        return 0;
     }
 
     int bit_shift = 7 - bitmap_index % 8;
@@ -70,6 +102,7 @@ void *Chunk::allocate(size_t bytes_requested)
             if (bitmap[byte_index] & (1 << bit_shift))
             {
                 set_free(false, i, segment_size);
+                ++allocation_count;
 
                 return static_cast<void *>(&memory[i * segment_size]);
             }
@@ -87,8 +120,6 @@ bool Chunk::free(void *segment, size_t size)
 {
     int offset = static_cast<char *>(segment) - memory;
 
-    log_bits(bitmap, bitmap_size);
-
     if (offset >= 0 && offset < memory_size)
     {
         size_t segment_size = MIN_SEGMENT_SIZE;
@@ -106,15 +137,136 @@ bool Chunk::free(void *segment, size_t size)
     return false;
 }
 
+size_t Chunk::get_size() const
+{
+    return memory_size;
+}
+
+size_t Chunk::get_free_bytes() const
+{
+    return free_bytes_count;
+}
+
+size_t Chunk::get_largest_free_segment() const
+{
+    if (!memory)
+    {
+        return 0;
+    }
+
+    size_t level = 0;
+    while ((max_segments_count >> level) > 1)
+    {
+        ++level;
+    }
+
+    for (++level; level--;)
+    {
+        if (free_segment_counts[level])
+        {
+            return size_t(MIN_SEGMENT_SIZE) << level;
+        }
+    }
+
+    return 0;
+}
+
+size_t Chunk::release_if_idle(size_t idle_passes, size_t max_bytes)
+{
+    // filled and emptied again since the last call: its pages are back in use
+    bool reused = allocation_count != released_allocation_count;
+    released_allocation_count = allocation_count;
+
+    if (reused || !memory || free_bytes_count != memory_size)
+    {
+        empty_passes = 0;
+        released_bytes = 0;
+    }
+
+    // pages of a caller's buffer may be huge pages, a shared file mapping or a stack, so they are left alone
+    if (!memory || external_memory || free_bytes_count != memory_size)
+    {
+        return 0;
+    }
+
+    if (++empty_passes <= idle_passes)
+    {
+        return 0;
+    }
+
+#ifdef __linux__
+    static size_t page_size = sysconf(_SC_PAGESIZE);
+
+    // the bitmap shares the allocation, after the segments, so only whole pages of segments are released
+    uintptr_t start = (reinterpret_cast<uintptr_t>(memory) + page_size - 1) & ~(page_size - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(memory + memory_size) & ~(page_size - 1);
+
+    if (start + released_bytes >= end)
+    {
+        return 0;
+    }
+
+    size_t release_size = end - start - released_bytes;
+    release_size = release_size < max_bytes ? release_size : max_bytes & ~(page_size - 1);
+
+    end -= released_bytes;
+
+    if (!release_size || madvise(reinterpret_cast<void *>(end - release_size), release_size, MADV_DONTNEED))
+    {
+        return 0;
+    }
+
+    released_bytes += release_size;
+
+    return release_size;
+#else
+    return 0;
+#endif
+}
+
+void Chunk::dump_orders(FILE *file, size_t chunk_index) const
+{
+    size_t bit_index = 0, segment_size = MIN_SEGMENT_SIZE;
+
+    for (size_t segments_count = max_segments_count; segments_count; segments_count /= 2)
+    {
+        size_t free_segments = 0;
+
+        for (size_t i = 0; i < segments_count; ++i)
+        {
+            free_segments += is_bit_set(bit_index + i);
+        }
+
+        fprintf(file, "order,%zu,%zu,%zu,%zu\n", chunk_index, segment_size, free_segments, segments_count);
+
+        bit_index += segments_count;
+        segment_size *= 2;
+    }
+}
+
+bool Chunk::is_bit_set(size_t bit_index) const
+{
+    return bitmap[bit_index / 8] & (1 << (7 - bit_index % 8));
+}
+
 Chunk::operator bool()
 {
     return !!memory;
 }
 
-void Chunk::set_bitmap_size()
+void Chunk::set_sizes(size_t size)
 {
+    assert("Chunk size cannot be less than " STRING(MIN_SEGMENT_SIZE) " bytes" && size >= MIN_SEGMENT_SIZE);
+
+    memory_size = MIN_SEGMENT_SIZE;
+    do
+    {
+        memory_size *= 2;
+    } while (memory_size < size);
+
     max_segments_count = memory_size / MIN_SEGMENT_SIZE;
 
+    bitmap_size = 1;
     size_t segments_count = max_segments_count;
     do
     {
@@ -129,7 +281,7 @@ void Chunk::set_free(bool free, size_t segment_offset, size_t segment_size)
 {
     size_t subsegments_count = segment_size / MIN_SEGMENT_SIZE, segments_count = max_segments_count;
 
-    size_t segments_bit_index = 0;
+    size_t segments_bit_index = 0, level = 0;
 
     while (subsegments_count)
     {
@@ -147,6 +299,11 @@ void Chunk::set_free(bool free, size_t segment_offset, size_t segment_size)
             unsigned char focused_bits = ~0u << (8 - focused_bits_count);
             focused_bits >>= bit_offset;
 
+            // only the bits that flip change the count
+            size_t flipped_count = __builtin_popcount((bitmap[byte_index] ^ (focused_bits * free)) & focused_bits);
+            free_segment_counts[level] =
+                free ? free_segment_counts[level] + flipped_count : free_segment_counts[level] - flipped_count;
+
             bitmap[byte_index] = (bitmap[byte_index] & ~focused_bits) | (focused_bits * free);
 
             ++byte_index;
@@ -157,6 +314,7 @@ void Chunk::set_free(bool free, size_t segment_offset, size_t segment_size)
 
         segments_count /= 2;
         subsegments_count /= 2;
+        ++level;
     }
 
     if (!free)
@@ -172,11 +330,13 @@ void Chunk::set_free(bool free, size_t segment_offset, size_t segment_size)
 
             unsigned char bit_to_unset = 1 << (7 - bit_offset);
 
-            bitmap[byte_index] = bitmap[byte_index] ^ bit_to_unset;
+            free_segment_counts[level] -= !!(bitmap[byte_index] & bit_to_unset);
+            bitmap[byte_index] = bitmap[byte_index] & ~bit_to_unset;
 
             segments_bit_index += segments_count;
 
             segments_count /= 2;
+            ++level;
         }
     }
 
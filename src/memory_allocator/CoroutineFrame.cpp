@@ -0,0 +1,75 @@
+#include "memory_allocator/CoroutineFrame.h"
+
+CoroutineFramePool::CoroutineFramePool(size_t size) : chunk(size)
+{
+}
+
+void CoroutineFramePool::deallocate_remote(void *mem, size_t size)
+{
+    FreeFrame *frame = static_cast<FreeFrame *>(mem);
+    frame->size_class = get_size_class(size);
+    frame->next = remote_frees.load(std::memory_order_relaxed);
+
+    while (!remote_frees.compare_exchange_weak(frame->next, frame, std::memory_order_release,
+                                               std::memory_order_relaxed))
+    {
+    }
+
+    // the last frame of a pool whose thread has exited
+    if (remote_free_count.fetch_add(1, std::memory_order_acq_rel) + 1 == 0)
+    {
+        delete this;
+    }
+}
+
+void CoroutineFramePool::drain_remote_frees()
+{
+    FreeFrame *frame = remote_frees.exchange(0, std::memory_order_acquire);
+
+    while (frame)
+    {
+        FreeFrame *next = frame->next;
+
+        frame->next = free_lists[frame->size_class];
+        free_lists[frame->size_class] = frame;
+
+        frame = next;
+    }
+}
+
+void CoroutineFramePool::release()
+{
+    // frames freed on other threads are counted in both
+    if (remote_free_count.fetch_sub(live_frames, std::memory_order_acq_rel) == live_frames)
+    {
+        delete this;
+    }
+}
+
+// Set while the thread's ThreadPool is alive. Trivially destructible, so thread_local destructors that run after the
+// ThreadPool's can still read it.
+static thread_local CoroutineFramePool *thread_pool_pointer = 0;
+
+CoroutineFramePool &CoroutineFramePool::get_thread()
+{
+    // the pool outlives the thread while frames it created are alive elsewhere
+    struct ThreadPool
+    {
+        CoroutineFramePool *pool = thread_pool_pointer = new CoroutineFramePool(1024 * 1024);
+
+        ~ThreadPool()
+        {
+            thread_pool_pointer = 0;
+            pool->release();
+        }
+    };
+
+    thread_local ThreadPool thread_pool;
+
+    return *thread_pool.pool;
+}
+
+CoroutineFramePool *CoroutineFramePool::find_thread()
+{
+    return thread_pool_pointer;
+}
@@ -0,0 +1,276 @@
+#include "memory_allocator/EpochReclaimer.h"
+
+#include <stdexcept>
+#include <unordered_map>
+
+// Threads find a reclaimer's Records through its id, so a thread that outlives a reclaimer never touches it
+static std::mutex &get_registry_mutex()
+{
+    static std::mutex mutex;
+
+    return mutex;
+}
+
+static std::unordered_map<uint64_t, EpochReclaimer *> &get_registry()
+{
+    static std::unordered_map<uint64_t, EpochReclaimer *> registry;
+
+    return registry;
+}
+
+// The Records of the reclaimers a thread uses, handed back when the thread exits or the slot is taken over
+struct EpochThreadState
+{
+    struct Slot
+    {
+        uint64_t id = 0;
+        EpochReclaimer::Record *record = 0;
+    };
+
+    ~EpochThreadState()
+    {
+        for (Slot &slot : slots)
+        {
+            release(slot);
+        }
+    }
+
+    static void release(Slot &slot)
+    {
+        if (!slot.id)
+        {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(get_registry_mutex());
+
+        auto it = get_registry().find(slot.id);
+        if (it != get_registry().end())
+        {
+            it->second->release_record(slot.record);
+        }
+
+        slot.id = 0;
+        slot.record = 0;
+    }
+
+    Slot slots[EpochReclaimer::THREAD_RECLAIMERS];
+
+    // taken over when every slot is in use
+    size_t next_evicted = 0;
+};
+
+static thread_local EpochThreadState thread_state;
+
+EpochReclaimer::EpochReclaimer(size_t batch_size) : batch_size(batch_size ? batch_size : 1)
+{
+    static std::atomic<uint64_t> next_id{1};
+
+    id = next_id++;
+
+    std::lock_guard<std::mutex> lock(get_registry_mutex());
+    get_registry()[id] = this;
+}
+
+EpochReclaimer::~EpochReclaimer()
+{
+    {
+        std::lock_guard<std::mutex> lock(get_registry_mutex());
+        get_registry().erase(id);
+    }
+
+    for (Record &record : records)
+    {
+        free_safe(record.retired, ~uint64_t(0));
+    }
+
+    free_safe(orphans, ~uint64_t(0));
+}
+
+EpochReclaimer::Guard::Guard(EpochReclaimer &reclaimer) : record(reclaimer.get_record())
+{
+    if (record->depth++)
+    {
+        return;
+    }
+
+    uint64_t current = reclaimer.epoch.load(std::memory_order_relaxed);
+
+    // the epoch may advance between reading and announcing it; announce again until it holds still
+    while (true)
+    {
+        record->announced.store(current, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        uint64_t latest = reclaimer.epoch.load(std::memory_order_relaxed);
+
+        if (latest == current)
+        {
+            break;
+        }
+
+        current = latest;
+    }
+}
+
+EpochReclaimer::Guard::~Guard()
+{
+    if (!--record->depth)
+    {
+        record->announced.store(0, std::memory_order_release);
+    }
+}
+
+void EpochReclaimer::retire(void *mem, FreeFunction free, void *context)
+{
+    Record *record = get_record();
+
+    record->retired.push_back({mem, free, context, epoch.load(std::memory_order_seq_cst)});
+    pending_count.fetch_add(1, std::memory_order_relaxed);
+
+    if (record->retired.size() >= batch_size)
+    {
+        collect();
+    }
+}
+
+size_t EpochReclaimer::collect()
+{
+    Record *record = get_record();
+
+    try_advance();
+
+    uint64_t current = epoch.load(std::memory_order_seq_cst);
+    size_t freed = free_safe(record->retired, current);
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return freed + free_safe(orphans, current);
+}
+
+uint64_t EpochReclaimer::get_epoch() const
+{
+    return epoch.load(std::memory_order_relaxed);
+}
+
+size_t EpochReclaimer::get_pending_count() const
+{
+    return pending_count.load(std::memory_order_relaxed);
+}
+
+EpochReclaimer::Record *EpochReclaimer::get_record()
+{
+    EpochThreadState &state = thread_state;
+
+    EpochThreadState::Slot *free_slot = 0;
+
+    for (EpochThreadState::Slot &slot : state.slots)
+    {
+        if (slot.id == id)
+        {
+            return slot.record;
+        }
+
+        free_slot = !free_slot && !slot.id ? &slot : free_slot;
+    }
+
+    // a slot whose reclaimer is guarded cannot be taken over, or its reader would be forgotten
+    for (size_t i = 0; !free_slot && i < THREAD_RECLAIMERS; ++i)
+    {
+        EpochThreadState::Slot &slot = state.slots[state.next_evicted++ % THREAD_RECLAIMERS];
+
+        if (!slot.record->depth)
+        {
+            free_slot = &slot;
+        }
+    }
+
+    if (!free_slot)
+    {
+        throw std::runtime_error("EpochReclaimer: a thread guards too many reclaimers at once");
+    }
+
+    EpochThreadState::release(*free_slot);
+
+    free_slot->record = acquire_record();
+    free_slot->id = id;
+
+    return free_slot->record;
+}
+
+EpochReclaimer::Record *EpochReclaimer::acquire_record()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (Record &record : records)
+    {
+        if (!record.in_use)
+        {
+            record.in_use = true;
+
+            return &record;
+        }
+    }
+
+    records.emplace_back();
+    records.back().in_use = true;
+
+    return &records.back();
+}
+
+void EpochReclaimer::release_record(Record *record)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    orphans.insert(orphans.end(), record->retired.begin(), record->retired.end());
+
+    record->retired.clear();
+    record->announced.store(0, std::memory_order_release);
+    record->depth = 0;
+    record->in_use = false;
+}
+
+bool EpochReclaimer::try_advance()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    uint64_t current = epoch.load(std::memory_order_seq_cst);
+
+    // a reader still in the previous epoch may hold blocks retired in it
+    for (const Record &record : records)
+    {
+        uint64_t announced = record.announced.load(std::memory_order_seq_cst);
+
+        if (announced && announced != current)
+        {
+            return false;
+        }
+    }
+
+    return epoch.compare_exchange_strong(current, current + 1, std::memory_order_seq_cst);
+}
+
+size_t EpochReclaimer::free_safe(std::vector<Retired> &retired, uint64_t current)
+{
+    size_t kept = 0;
+
+    for (const Retired &block : retired)
+    {
+        // retired at epoch e, a block may be seen by readers that announced e - 1 or e, and none remain at e + 2
+        if (block.epoch + 2 <= current || current == ~uint64_t(0))
+        {
+            block.free(block.context, block.mem);
+        }
+        else
+        {
+            retired[kept++] = block;
+        }
+    }
+
+    size_t freed = retired.size() - kept;
+    retired.resize(kept);
+
+    pending_count.fetch_sub(freed, std::memory_order_relaxed);
+
+    return freed;
+}
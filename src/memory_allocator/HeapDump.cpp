@@ -0,0 +1,53 @@
+#include "memory_allocator/HeapDump.h"
+
+#include <cstdio>
+#include <cstring>
+
+bool HeapDump::read(const char *path, HeapDump &dump)
+{
+    FILE *file = fopen(path, "r");
+
+    if (!file)
+    {
+        return false;
+    }
+
+    char line[256];
+    bool valid = fgets(line, sizeof(line), file) && !strncmp(line, HEADER, strlen(HEADER));
+
+    while (valid && fgets(line, sizeof(line), file))
+    {
+        Block block;
+        Order order;
+        size_t index, size;
+        char state[8];
+
+        if (sscanf(line, "arena,%zu,%zu,%zu", &dump.capacity, &dump.headers_used, &dump.header_capacity) == 3)
+        {
+            continue;
+        }
+
+        if (sscanf(line, "block,%zu,%zu,%7[a-z],%u", &block.offset, &block.size, state, &block.tag) == 4)
+        {
+            block.free = !strcmp(state, "free");
+            dump.blocks.push_back(block);
+        }
+        else if (sscanf(line, "chunk,%zu,%zu", &index, &size) == 2)
+        {
+            dump.chunk_sizes.push_back(size);
+        }
+        else if (sscanf(line, "order,%zu,%zu,%zu,%zu", &order.chunk, &order.segment_size, &order.free_segments,
+                        &order.segment_count) == 4)
+        {
+            dump.orders.push_back(order);
+        }
+        else
+        {
+            valid = false;
+        }
+    }
+
+    fclose(file);
+
+    return valid;
+}
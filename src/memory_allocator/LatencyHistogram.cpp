@@ -0,0 +1,67 @@
+#include "memory_allocator/LatencyHistogram.h"
+
+#include <cmath>
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for (size_t i = 0; i < BUCKET_COUNT; ++i)
+    {
+        counts[i] += other.counts[i];
+    }
+
+    count += other.count;
+    max = other.max > max ? other.max : max;
+}
+
+void LatencyHistogram::clear()
+{
+    *this = LatencyHistogram();
+}
+
+uint64_t LatencyHistogram::get_percentile(double percentile) const
+{
+    if (!count)
+    {
+        return 0;
+    }
+
+    uint64_t rank = uint64_t(std::ceil(percentile / 100 * count));
+    rank = rank < 1 ? 1 : rank > count ? count : rank;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i)
+    {
+        seen += counts[i];
+
+        if (seen >= rank)
+        {
+            uint64_t upper_bound = get_bucket_upper_bound(i);
+
+            return upper_bound < max ? upper_bound : max;
+        }
+    }
+
+    return max;
+}
+
+uint64_t LatencyHistogram::get_bucket_upper_bound(size_t bucket)
+{
+    if (bucket < 4)
+    {
+        return bucket;
+    }
+
+    size_t msb = bucket / 4 + 1, sub_bucket = bucket % 4;
+
+    // values with this top bit, whose next two bits are sub_bucket
+    uint64_t lower_bound = (uint64_t(4 + sub_bucket)) << (msb - 2);
+
+    return lower_bound + (uint64_t(1) << (msb - 2)) - 1;
+}
+
+LatencyStats &LatencyStats::get_thread()
+{
+    thread_local LatencyStats stats;
+
+    return stats;
+}
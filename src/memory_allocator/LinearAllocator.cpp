@@ -1,24 +1,66 @@
 #include "memory_allocator/LinearAllocator.h"
 
-LinearAllocator::LinearAllocator(size_t size)
+#include <cassert>
+
+LinearAllocator::LinearAllocator(size_t size) : LinearAllocator(malloc(size), size)
+{
+    external_memory = false;
+}
+
+LinearAllocator::LinearAllocator(void *buffer, size_t size) : external_memory(true)
 {
-    begin = static_cast<char *>(malloc(size));
+    begin = static_cast<char *>(buffer);
     memset(begin, 0, size);
 
     cursor = begin;
     end = begin + size;
+
+    peak = begin;
 }
 
 LinearAllocator::~LinearAllocator()
 {
-    free(begin);
+    if (!external_memory)
+    {
+        ::free(begin);
+    }
 }
 
 void LinearAllocator::free(void *mem)
 {
     if (mem >= begin && mem < cursor)
     {
+        if (budget)
+        {
+            budget->release(cursor - static_cast<char *>(mem));
+        }
+
         memset(mem, 0, cursor - static_cast<char *>(mem));
         cursor = static_cast<char *>(mem);
     }
 }
+
+void LinearAllocator::reset()
+{
+    free(begin);
+}
+
+void LinearAllocator::set_budget(MemoryBudget *budget)
+{
+    assert(cursor == begin && "LinearAllocator::set_budget: memory is in use");
+
+    LinearAllocator::budget = budget;
+}
+
+AllocatorStats LinearAllocator::get_stats() const
+{
+    AllocatorStats stats;
+
+    stats.capacity = end - begin;
+    stats.bytes_in_use = cursor - begin;
+    stats.free_bytes = end - cursor;
+    stats.largest_free_block = stats.free_bytes;
+    stats.high_water_mark = peak - begin;
+
+    return stats;
+}
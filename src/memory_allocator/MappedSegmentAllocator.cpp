@@ -1,7 +1,11 @@
 #include "memory_allocator/MappedSegmentAllocator.h"
 
+#include <cassert>
+#include <cstdio>
 #include <new>
 
+#include "memory_allocator/HeapDump.h"
+
 MappedSegmentAllocator::MappedSegmentAllocator()
 {
     chunks = static_cast<Chunk *>(malloc(sizeof(Chunk) * max_chunks));
@@ -14,7 +18,7 @@ MappedSegmentAllocator::~MappedSegmentAllocator()
         chunks[i].~Chunk();
     }
 
-    free(chunks);
+    ::free(chunks);
 }
 
 bool MappedSegmentAllocator::add_chunk(size_t size)
@@ -25,7 +29,85 @@ bool MappedSegmentAllocator::add_chunk(size_t size)
     }
 
     new (chunks + chunk_count) Chunk(size);
+    capacity += chunks[chunk_count].get_size();
+
     ++chunk_count;
 
     return true;
 }
+
+bool MappedSegmentAllocator::add_chunk(void *buffer, size_t size)
+{
+    if (chunk_count == max_chunks)
+    {
+        return false;
+    }
+
+    new (chunks + chunk_count) Chunk(buffer, size);
+    capacity += chunks[chunk_count].get_size();
+
+    ++chunk_count;
+
+    return true;
+}
+
+void MappedSegmentAllocator::set_budget(MemoryBudget *budget)
+{
+    assert(!used_bytes && "MappedSegmentAllocator::set_budget: blocks are in use");
+
+    MappedSegmentAllocator::budget = budget;
+}
+
+size_t MappedSegmentAllocator::release_idle_memory(size_t idle_passes, size_t max_bytes)
+{
+    size_t released = 0;
+
+    for (size_t i = 0; i < chunk_count; ++i)
+    {
+        released += chunks[i].release_if_idle(idle_passes, max_bytes - released);
+    }
+
+    return released;
+}
+
+AllocatorStats MappedSegmentAllocator::get_stats() const
+{
+    AllocatorStats stats;
+
+    stats.capacity = capacity;
+    stats.bytes_in_use = used_bytes;
+    stats.free_bytes = capacity - used_bytes;
+    stats.high_water_mark = peak_used_bytes;
+
+    for (size_t i = 0; i < chunk_count; ++i)
+    {
+        size_t largest = chunks[i].get_largest_free_segment();
+        stats.largest_free_block = largest > stats.largest_free_block ? largest : stats.largest_free_block;
+    }
+
+    stats.fragmentation = stats.free_bytes ? 1 - double(stats.largest_free_block) / stats.free_bytes : 0;
+
+    return stats;
+}
+
+bool MappedSegmentAllocator::dump(const char *path) const
+{
+    FILE *file = fopen(path, "w");
+
+    if (!file)
+    {
+        return false;
+    }
+
+    fprintf(file, "%s\narena,%zu,0,0\n", HeapDump::HEADER, capacity);
+
+    for (size_t i = 0; i < chunk_count; ++i)
+    {
+        fprintf(file, "chunk,%zu,%zu\n", i, chunks[i].get_size());
+        chunks[i].dump_orders(file, i);
+    }
+
+    bool written = !ferror(file);
+
+    return !fclose(file) && written;
+}
@@ -0,0 +1,61 @@
+#include "memory_allocator/MemoryBudget.h"
+
+#include <algorithm>
+
+MemoryBudget::MemoryBudget(size_t soft_limit, size_t hard_limit)
+    : soft_limit(soft_limit), hard_limit(hard_limit), check_limit(std::min(soft_limit, hard_limit))
+{
+}
+
+void MemoryBudget::set_limits(size_t soft_limit, size_t hard_limit)
+{
+    MemoryBudget::soft_limit = soft_limit;
+    MemoryBudget::hard_limit = hard_limit;
+
+    check_limit = std::min(soft_limit, hard_limit);
+}
+
+void MemoryBudget::add_pressure_callback(PressureCallback callback)
+{
+    callbacks.push_back(std::move(callback));
+}
+
+size_t MemoryBudget::get_bytes_in_use() const
+{
+    return bytes_in_use;
+}
+
+size_t MemoryBudget::get_soft_limit() const
+{
+    return soft_limit;
+}
+
+size_t MemoryBudget::get_hard_limit() const
+{
+    return hard_limit;
+}
+
+bool MemoryBudget::reserve_checked(size_t size)
+{
+    // crossing the soft limit now, rather than already past it
+    if (bytes_in_use <= soft_limit && bytes_in_use + size > soft_limit && !notifying)
+    {
+        notifying = true;
+
+        for (const PressureCallback &callback : callbacks)
+        {
+            callback(bytes_in_use + size);
+        }
+
+        notifying = false;
+    }
+
+    if (bytes_in_use + size > hard_limit)
+    {
+        return false;
+    }
+
+    bytes_in_use += size;
+
+    return true;
+}
@@ -0,0 +1,71 @@
+#include "memory_allocator/MemoryScavenger.h"
+
+MemoryScavenger::MemoryScavenger(std::chrono::milliseconds interval, std::chrono::milliseconds idle_time,
+                                 size_t max_bytes_per_second)
+    : interval(interval.count() > 0 ? interval : std::chrono::milliseconds(1))
+{
+    // a range counts as idle once it has been free at this many passes in a row
+    idle_passes = (idle_time.count() + MemoryScavenger::interval.count() - 1) / MemoryScavenger::interval.count();
+
+    double max_bytes = double(max_bytes_per_second) * MemoryScavenger::interval.count() / 1000;
+    max_bytes_per_pass = max_bytes < double(~size_t(0)) ? size_t(max_bytes) : ~size_t(0);
+
+    worker = std::thread(&MemoryScavenger::run, this);
+}
+
+MemoryScavenger::~MemoryScavenger()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+
+    stop_requested.notify_one();
+    worker.join();
+}
+
+void MemoryScavenger::add(ReleaseFunction release)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    releases.push_back(std::move(release));
+}
+
+size_t MemoryScavenger::scavenge()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return scavenge_locked();
+}
+
+size_t MemoryScavenger::get_released_bytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return released_bytes;
+}
+
+size_t MemoryScavenger::scavenge_locked()
+{
+    size_t released = 0;
+
+    // every allocator makes its pass, so idle ranges are counted even once the rate limit is reached
+    for (const ReleaseFunction &release : releases)
+    {
+        released += release(idle_passes, max_bytes_per_pass - released);
+    }
+
+    released_bytes += released;
+
+    return released;
+}
+
+void MemoryScavenger::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (!stop_requested.wait_for(lock, interval, [this] { return stopping; }))
+    {
+        scavenge_locked();
+    }
+}
@@ -0,0 +1,83 @@
+#include "memory_allocator/PoolAllocator.h"
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+
+PoolAllocator::~PoolAllocator()
+{
+    free_slabs();
+}
+
+void PoolAllocator::init(size_t block_size, size_t alignment, size_t blocks_per_slab)
+{
+    assert(block_size && "block_size must be non-zero");
+    assert(blocks_per_slab && "blocks_per_slab must be non-zero");
+
+    free_slabs();
+
+    PoolAllocator::block_size = get_block_stride(block_size, alignment);
+    PoolAllocator::alignment = get_block_alignment(alignment);
+    PoolAllocator::blocks_per_slab = blocks_per_slab;
+}
+
+bool PoolAllocator::add_slab()
+{
+    assert(block_size && blocks_per_slab && "PoolAllocator used before init");
+
+    Slab *slab = static_cast<Slab *>(malloc(sizeof(Slab) + alignment - 1 + block_size * blocks_per_slab));
+
+    if (!slab)
+    {
+        return false;
+    }
+
+    slab->next = slabs;
+    slabs = slab;
+
+    ++slab_count;
+
+    uintptr_t first_block = (reinterpret_cast<uintptr_t>(slab + 1) + alignment - 1) & ~uintptr_t(alignment - 1);
+    char *blocks = reinterpret_cast<char *>(first_block);
+
+    // push in reverse so blocks are handed out in address order
+    for (size_t i = blocks_per_slab; i--;)
+    {
+        FreeBlock *block = reinterpret_cast<FreeBlock *>(blocks + i * block_size);
+
+        block->next = free_list;
+        free_list = block;
+    }
+
+    return true;
+}
+
+void PoolAllocator::free_slabs()
+{
+    while (slabs)
+    {
+        Slab *next = slabs->next;
+
+        free(slabs);
+        slabs = next;
+    }
+
+    free_list = 0;
+
+    slab_count = 0;
+    live_count = 0;
+    peak_live_count = 0;
+}
+
+AllocatorStats PoolAllocator::get_stats() const
+{
+    AllocatorStats stats;
+
+    stats.capacity = slab_count * blocks_per_slab * block_size;
+    stats.bytes_in_use = live_count * block_size;
+    stats.free_bytes = stats.capacity - stats.bytes_in_use;
+    stats.largest_free_block = stats.free_bytes ? block_size : 0;
+    stats.high_water_mark = peak_live_count * block_size;
+
+    return stats;
+}
@@ -0,0 +1,360 @@
+#include "memory_allocator/SharedBlockAllocator.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <new>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr uint64_t MAGIC = 0x314b4c4248534d41; // "AMSHBLK1"
+
+static void init_mutex(pthread_mutex_t *mutex)
+{
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(mutex, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+}
+
+// At the start of the mapping, followed by the arena
+struct SharedBlockAllocator::Control
+{
+    std::atomic<uint64_t> magic{0};
+
+    // a file written by a build with another layout is not mapped
+    size_t control_size = sizeof(Control);
+
+    size_t mapped_size = 0;
+
+    pthread_mutex_t mutex;
+
+    // offset of the root object from the start of the mapping, or 0
+    size_t root = 0;
+
+    // set once a process died holding the lock
+    bool poisoned = false;
+
+    // Its arena, bitmap, sizes and tags pointers are those of the process that last took the lock, so it is rebased on
+    // every lock. Its counters, and the remote free list, which stays empty without an owner thread, hold no
+    // addresses. Its other pointers and its owner thread would mean nothing in another process and are never set:
+    // mapped large allocations, trace, sampler, budget and idle ranges.
+    BlockAllocator allocator;
+};
+
+class SharedBlockAllocator::Lock
+{
+  public:
+    explicit Lock(const SharedBlockAllocator &shared) : control(shared.control)
+    {
+        // the owner may have died in the middle of updating the headers
+        if (pthread_mutex_lock(&control->mutex) == EOWNERDEAD)
+        {
+            control->poisoned = true;
+            pthread_mutex_consistent(&control->mutex);
+        }
+
+        control->allocator.rebase(shared.get_arena());
+    }
+
+    ~Lock()
+    {
+        pthread_mutex_unlock(&control->mutex);
+    }
+
+  private:
+    Control *control;
+};
+
+SharedBlockAllocator::~SharedBlockAllocator()
+{
+    detach();
+}
+
+bool SharedBlockAllocator::create(const char *name, size_t memory_size, size_t max_block_count)
+{
+    detach();
+
+    int new_fd;
+
+    if (name)
+    {
+        shm_unlink(name);
+        new_fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    else
+    {
+#ifdef __linux__
+        new_fd = memfd_create("memory_allocator", MFD_CLOEXEC);
+#else
+        new_fd = -1;
+#endif
+    }
+
+    if (new_fd < 0)
+    {
+        return false;
+    }
+
+    if (!initialize(new_fd, memory_size, max_block_count))
+    {
+        if (name)
+        {
+            shm_unlink(name);
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+bool SharedBlockAllocator::open(const char *path, size_t memory_size, size_t max_block_count)
+{
+    detach();
+
+    int new_fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+    if (new_fd < 0)
+    {
+        return false;
+    }
+
+    // every process with the file open holds a shared lock on it, so one that gets the exclusive lock is alone
+    if (flock(new_fd, LOCK_EX | LOCK_NB))
+    {
+        // waits for the process that has it to finish initializing the file
+        if (flock(new_fd, LOCK_SH))
+        {
+            close(new_fd);
+
+            return false;
+        }
+
+        return map(new_fd);
+    }
+
+    // initialize stores the magic last, so a file without it is new, or was left by a process that died initializing it
+    uint64_t magic = 0;
+    bool initialized = pread(new_fd, &magic, sizeof(magic), 0) > 0 && magic;
+
+    bool mapped = !initialized ? initialize(new_fd, memory_size, max_block_count) : map(new_fd);
+
+    if (mapped && initialized)
+    {
+        // a file synced while the lock was held, then kept over a crash of the system, has it held by a thread that
+        // no longer exists
+        init_mutex(&control->mutex);
+    }
+
+    if (mapped)
+    {
+        flock(fd, LOCK_SH);
+    }
+
+    return mapped;
+}
+
+bool SharedBlockAllocator::sync()
+{
+    Lock lock(*this);
+
+    return !msync(control, mapped_size, MS_SYNC);
+}
+
+bool SharedBlockAllocator::initialize(int new_fd, size_t memory_size, size_t max_block_count)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t size = get_arena_offset() + BlockAllocator::get_buffer_size(memory_size, max_block_count);
+    size = (size + page_size - 1) & ~(page_size - 1);
+
+    void *base = MAP_FAILED;
+
+    if (!ftruncate(new_fd, size))
+    {
+        base = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, new_fd, 0);
+    }
+
+    if (base == MAP_FAILED)
+    {
+        close(new_fd);
+
+        return false;
+    }
+
+    control = new (base) Control;
+    control->mapped_size = size;
+
+    init_mutex(&control->mutex);
+
+    mapped_size = size;
+    fd = new_fd;
+
+    control->allocator.init(get_arena(), memory_size, max_block_count);
+
+    // processes attaching before this point find no arena
+    control->magic.store(MAGIC, std::memory_order_release);
+
+    return true;
+}
+
+bool SharedBlockAllocator::attach(const char *name)
+{
+    detach();
+
+    int new_fd = shm_open(name, O_RDWR, 0);
+
+    if (new_fd < 0)
+    {
+        return false;
+    }
+
+    return map(new_fd);
+}
+
+bool SharedBlockAllocator::attach(int fd)
+{
+    detach();
+
+    int new_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+
+    if (new_fd < 0)
+    {
+        return false;
+    }
+
+    return map(new_fd);
+}
+
+bool SharedBlockAllocator::map(int new_fd)
+{
+    struct stat status;
+
+    void *base = MAP_FAILED;
+
+    if (!fstat(new_fd, &status) && size_t(status.st_size) >= sizeof(Control))
+    {
+        base = mmap(0, status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, new_fd, 0);
+    }
+
+    if (base == MAP_FAILED)
+    {
+        close(new_fd);
+
+        return false;
+    }
+
+    Control *mapped = static_cast<Control *>(base);
+
+    if (mapped->magic.load(std::memory_order_acquire) != MAGIC || mapped->control_size != sizeof(Control) ||
+        mapped->mapped_size != size_t(status.st_size))
+    {
+        munmap(base, status.st_size);
+        close(new_fd);
+
+        return false;
+    }
+
+    control = mapped;
+    mapped_size = status.st_size;
+    fd = new_fd;
+
+    return true;
+}
+
+void SharedBlockAllocator::detach()
+{
+    if (control)
+    {
+        munmap(control, mapped_size);
+
+        control = 0;
+        mapped_size = 0;
+    }
+
+    if (fd >= 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+}
+
+int SharedBlockAllocator::get_fd() const
+{
+    return fd;
+}
+
+bool SharedBlockAllocator::remove(const char *name)
+{
+    return !shm_unlink(name);
+}
+
+void *SharedBlockAllocator::allocate(size_t size, size_t alignment)
+{
+    Lock lock(*this);
+
+    return control->poisoned ? 0 : control->allocator.allocate(size, alignment);
+}
+
+void SharedBlockAllocator::deallocate(void *mem)
+{
+    Lock lock(*this);
+
+    if (!control->poisoned)
+    {
+        control->allocator.deallocate(mem);
+    }
+}
+
+bool SharedBlockAllocator::owns(const void *mem) const
+{
+    return control && mem >= get_arena() && mem < reinterpret_cast<char *>(control) + mapped_size;
+}
+
+void SharedBlockAllocator::set_root(void *root)
+{
+    control->root = root ? static_cast<char *>(root) - reinterpret_cast<char *>(control) : 0;
+}
+
+void *SharedBlockAllocator::get_root() const
+{
+    return control->root ? reinterpret_cast<char *>(control) + control->root : 0;
+}
+
+AllocatorStats SharedBlockAllocator::get_stats() const
+{
+    Lock lock(*this);
+
+    return control->allocator.get_stats();
+}
+
+bool SharedBlockAllocator::is_poisoned() const
+{
+    Lock lock(*this);
+
+    return control->poisoned;
+}
+
+#ifdef BUILD_TESTS
+void SharedBlockAllocator::abandon_lock()
+{
+    pthread_mutex_lock(&control->mutex);
+}
+#endif
+
+size_t SharedBlockAllocator::get_arena_offset()
+{
+    return (sizeof(Control) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+}
+
+char *SharedBlockAllocator::get_arena() const
+{
+    return reinterpret_cast<char *>(control) + get_arena_offset();
+}
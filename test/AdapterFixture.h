@@ -13,6 +13,7 @@ template <typename ValueType> class AdapterFixture : public testing::Test
     void init(size_t memory_size, size_t max_block_count)
     {
         A::allocator.init(memory_size, max_block_count);
+        A::allocator.set_coalesce_policy(BlockAllocator::CoalescePolicy::Immediate);
         initialized = true;
     }
 
@@ -0,0 +1,208 @@
+#include <coroutine>
+#include <exception>
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "memory_allocator/CoroutineFrame.h"
+
+// A coroutine that runs to its co_return when resumed
+class Task
+{
+  public:
+    struct promise_type : CoroutineFrameAllocation
+    {
+        int value = 0;
+
+        Task get_return_object()
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_always final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_value(int value)
+        {
+            promise_type::value = value;
+        }
+
+        void unhandled_exception()
+        {
+            std::terminate();
+        }
+    };
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle)
+    {
+    }
+
+    Task(Task &&other) : handle(std::exchange(other.handle, {}))
+    {
+    }
+
+    ~Task()
+    {
+        if (handle)
+        {
+            handle.destroy();
+        }
+    }
+
+    int run()
+    {
+        handle.resume();
+
+        return handle.promise().value;
+    }
+
+    const void *get_frame() const
+    {
+        return handle.address();
+    }
+
+  private:
+    std::coroutine_handle<promise_type> handle;
+};
+
+static Task add(int a, int b)
+{
+    co_return a + b;
+}
+
+static Task add(std::allocator_arg_t, LinearAllocator &, int a, int b)
+{
+    co_return a + b;
+}
+
+struct Adder
+{
+    Task add(std::allocator_arg_t, LinearAllocator &, int a)
+    {
+        co_return base + a;
+    }
+
+    int base = 10;
+};
+
+TEST(CoroutineFrameTest, ThreadPool)
+{
+    CoroutineFramePool &pool = CoroutineFramePool::get_thread();
+    size_t free_bytes = pool.get_free_bytes();
+
+    {
+        Task first = add(1, 2);
+        EXPECT_LT(pool.get_free_bytes(), free_bytes);
+
+        // a freed frame is reused by the next coroutine of its size class
+        const void *frame = 0;
+        {
+            Task second = add(3, 4);
+            frame = second.get_frame();
+            EXPECT_EQ(second.run(), 7);
+        }
+
+        free_bytes = pool.get_free_bytes();
+
+        Task third = add(5, 6);
+        EXPECT_EQ(third.get_frame(), frame);
+        EXPECT_EQ(pool.get_free_bytes(), free_bytes);
+
+        EXPECT_EQ(first.run(), 3);
+        EXPECT_EQ(third.run(), 11);
+    }
+
+    Task fourth = add(7, 8);
+    Task fifth = add(9, 10);
+    EXPECT_EQ(pool.get_free_bytes(), free_bytes);
+    EXPECT_EQ(fourth.run() + fifth.run(), 34);
+}
+
+TEST(CoroutineFrameTest, OtherThreads)
+{
+    CoroutineFramePool &pool = CoroutineFramePool::get_thread();
+
+    // frames destroyed on another thread go back to this thread's pool
+    for (int round = 0; round < 2; ++round)
+    {
+        std::vector<Task> tasks;
+        for (int i = 0; i < 1000; ++i)
+        {
+            tasks.push_back(add(i, 1));
+        }
+
+        // without creating a pool of the destroying thread's own
+        std::thread([moved = std::move(tasks)]() mutable {
+            moved.clear();
+            EXPECT_FALSE(CoroutineFramePool::find_thread());
+        }).join();
+    }
+
+    size_t free_bytes = pool.get_free_bytes();
+    {
+        std::vector<Task> tasks;
+        for (int i = 0; i < 1000; ++i)
+        {
+            tasks.push_back(add(i, 1));
+        }
+        EXPECT_EQ(pool.get_free_bytes(), free_bytes);
+    }
+
+    // a frame outlives the thread that created it
+    Task *orphan = 0;
+    std::thread([&orphan] { orphan = new Task(add(5, 6)); }).join();
+    EXPECT_EQ(orphan->run(), 11);
+    delete orphan;
+
+    // destroyed by a thread_local destructor that runs after the thread's pool has been released
+    std::thread([] {
+        thread_local std::unique_ptr<Task> late;
+        late.reset(new Task(add(1, 2)));
+    }).join();
+}
+
+TEST(CoroutineFrameTest, RequestArena)
+{
+    alignas(std::max_align_t) char buffer[4096];
+    LinearAllocator arena(buffer, sizeof(buffer));
+    size_t pool_free_bytes = CoroutineFramePool::get_thread().get_free_bytes();
+
+    Adder adder;
+    {
+        Task task = add(std::allocator_arg, arena, 1, 2);
+        Task member = adder.add(std::allocator_arg, arena, 5);
+
+        EXPECT_GE(static_cast<const char *>(task.get_frame()), buffer);
+        EXPECT_LT(static_cast<const char *>(member.get_frame()), buffer + sizeof(buffer));
+
+        EXPECT_EQ(task.run(), 3);
+        EXPECT_EQ(member.run(), 15);
+    }
+
+    // the frames stay until the arena is reset
+    EXPECT_GT(arena.get_stats().bytes_in_use, 0);
+    EXPECT_EQ(CoroutineFramePool::get_thread().get_free_bytes(), pool_free_bytes);
+
+    arena.reset();
+    EXPECT_EQ(arena.get_stats().bytes_in_use, 0);
+
+    // frames are aligned like operator new after odd-sized allocations
+    arena.allocate<char>(3);
+    Task after_odd = add(std::allocator_arg, arena, 3, 4);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(after_odd.get_frame()) % __STDCPP_DEFAULT_NEW_ALIGNMENT__, 0);
+    EXPECT_EQ(after_odd.run(), 7);
+
+    // a full arena throws, like operator new
+    char small_buffer[32];
+    LinearAllocator small_arena(small_buffer, sizeof(small_buffer));
+    EXPECT_THROW(add(std::allocator_arg, small_arena, 1, 2), std::bad_alloc);
+}
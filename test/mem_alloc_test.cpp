@@ -1,80 +1,1438 @@
+#include <atomic>
+#include <condition_variable>
 #include <cstdlib>
+#include <deque>
 #include <gtest/gtest.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
 #include <unordered_map>
 
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include "./AdapterFixture.h"
+#include "memory_allocator/AllocationSampler.h"
+#include "memory_allocator/AllocationTrace.h"
+#include "memory_allocator/AsyncDeallocator.h"
 #include "memory_allocator/BlockAllocator.h"
+#include "memory_allocator/EpochReclaimer.h"
+#include "memory_allocator/HeapDump.h"
+#include "memory_allocator/InlineArena.h"
+#include "memory_allocator/LatencyHistogram.h"
 #include "memory_allocator/LinearAllocator.h"
+#include "memory_allocator/MappedSegmentAllocator.h"
+#include "memory_allocator/MemoryBudget.h"
+#include "memory_allocator/MemoryScavenger.h"
+#include "memory_allocator/PoolAllocator.h"
+#include "memory_allocator/SharedBlockAllocator.h"
+
+class TestClass
+{
+  public:
+    TestClass(bool &alive, int a, int b, int c) : alive(alive), a(a), b(b), c(c)
+    {
+        alive = true;
+    }
+
+    ~TestClass()
+    {
+        alive = false;
+    }
+
+    int a, b, c;
+
+    bool &alive;
+};
+
+TEST(BlockAllocatorTest, Allocate)
+{
+    constexpr size_t size = sizeof(int);
+
+    BlockAllocator allocator(size * 2, 2);
+
+    int *a = static_cast<int *>(allocator.allocate(size, alignof(int)));
+    ASSERT_TRUE(a);
+
+    int *b = static_cast<int *>(allocator.allocate(size, alignof(int)));
+    ASSERT_TRUE(b);
+
+    ASSERT_NE(a, b);
+}
+
+TEST(BlockAllocatorTest, OverAllocate)
+{
+    constexpr size_t size = sizeof(int);
+
+    BlockAllocator allocator(size, 1);
+
+    int *a = static_cast<int *>(allocator.allocate(size, alignof(int)));
+    ASSERT_TRUE(a);
+
+    int *b = static_cast<int *>(allocator.allocate(size, alignof(int)));
+    ASSERT_FALSE(b);
+}
+
+TEST(BlockAllocatorTest, Deallocate)
+{
+    constexpr size_t size = sizeof(int);
+
+    BlockAllocator allocator(size * 2, 2);
+
+    int *a = static_cast<int *>(allocator.allocate(size, alignof(int)));
+    ASSERT_TRUE(a);
+
+    int *b = static_cast<int *>(allocator.allocate(size, alignof(int)));
+    ASSERT_TRUE(b);
+
+    allocator.deallocate(b);
+    allocator.deallocate(a);
+
+    int *c = static_cast<int *>(allocator.allocate(size, alignof(int)));
+    ASSERT_EQ(a, c);
+
+    int *d = static_cast<int *>(allocator.allocate(size, alignof(int)));
+    ASSERT_EQ(b, d);
+}
+
+template <typename Allocator> class HeaderWordTest : public testing::Test
+{
+};
+
+using HeaderWordTypes = testing::Types<BlockAllocator, BasicBlockAllocator<uint32_t>, CompactBlockAllocator>;
+TYPED_TEST_SUITE(HeaderWordTest, HeaderWordTypes);
+
+TYPED_TEST(HeaderWordTest, ManyBlocksAcrossBitmapWords)
+{
+    constexpr size_t size = 16, count = 200;
+
+    TypeParam allocator(size * count, count);
+
+    char *blocks[count];
+    for (size_t i = 0; i < count; ++i)
+    {
+        blocks[i] = static_cast<char *>(allocator.allocate(size, size));
+        ASSERT_TRUE(blocks[i]);
+    }
+
+    for (size_t i = 1; i < count; i += 2)
+    {
+        allocator.deallocate(blocks[i]);
+    }
+
+    EXPECT_EQ(allocator.count_free_blocks(), count / 2);
+    EXPECT_FALSE(allocator.allocate(size * 2, size));
+
+    // merges blocks 99..101, the remainder of the split is inserted back into the free flags
+    allocator.deallocate(blocks[100]);
+    EXPECT_EQ(allocator.allocate(size * 2, size), blocks[99]);
+
+    allocator.deallocate(blocks[150]);
+    EXPECT_EQ(allocator.allocate(size * 3, size), blocks[149]);
+
+    EXPECT_EQ(allocator.allocate(size, size), blocks[1]);
+    EXPECT_EQ(allocator.count_free_blocks(), count / 2 - 4);
+}
+
+TEST(BlockAllocatorTest, CompactHeaderUnits)
+{
+    constexpr size_t unit = alignof(std::max_align_t);
+
+    CompactBlockAllocator allocator(unit * 4, 4);
+
+    char *a = static_cast<char *>(allocator.allocate(1, 1));
+    ASSERT_TRUE(a);
+
+    // sizes are rounded up to whole units
+    char *b = static_cast<char *>(allocator.allocate(1, 1));
+    ASSERT_EQ(b - a, unit);
+
+    ASSERT_TRUE(allocator.allocate(unit * 2 - 1, 1));
+    ASSERT_FALSE(allocator.allocate(1, 1));
+
+    allocator.deallocate(b);
+    EXPECT_EQ(allocator.get_largest_free_block(), unit);
+
+    EXPECT_THROW(allocator.deallocate(b + 1), std::runtime_error);
+}
+
+TEST(BlockAllocatorTest, CompactHeaderAdapter)
+{
+    using CompactAdapter = Adapter<int, CompactBlockAllocator>;
+
+    CompactAdapter::allocator.init(4096, 100);
+
+    {
+        std::vector<int, CompactAdapter> v;
+
+        for (int i = 0; i < 100; ++i)
+        {
+            v.push_back(i);
+        }
+
+        for (int i = 0; i < 100; ++i)
+        {
+            EXPECT_EQ(v[i], i);
+        }
+    }
+
+    EXPECT_EQ(CompactAdapter::allocator.count_free_blocks(), 1);
+    EXPECT_EQ(CompactAdapter::allocator.get_largest_free_block(), 4096);
+}
+
+TEST(BlockAllocatorTest, Reset)
+{
+    constexpr size_t size = sizeof(int);
+
+    BlockAllocator allocator(size * 4, 4);
+
+    int *a = static_cast<int *>(allocator.allocate(size, alignof(int)));
+    ASSERT_TRUE(a);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        ASSERT_TRUE(allocator.allocate(size, alignof(int)));
+    }
+
+    ASSERT_FALSE(allocator.allocate(size, alignof(int)));
+
+    size_t epoch = allocator.get_epoch();
+
+    allocator.reset();
+
+    EXPECT_EQ(allocator.get_epoch(), epoch + 1);
+    EXPECT_EQ(allocator.count_active_headers(), 1);
+    EXPECT_EQ(allocator.get_largest_free_block(), size * 4);
+
+    int *b = static_cast<int *>(allocator.allocate(size * 4, alignof(int)));
+    ASSERT_EQ(a, b);
+}
+
+TEST(BlockAllocatorTest, StaleHandles)
+{
+    BlockAllocator allocator(64, 4);
+
+    BlockAllocator::Handle a = allocator.allocate_handle(16);
+    ASSERT_TRUE(a.mem);
+    EXPECT_EQ(allocator.get(a), a.mem);
+
+    BlockAllocator::Handle resized = allocator.reallocate(a, 32);
+    ASSERT_TRUE(resized.mem);
+    allocator.deallocate(resized);
+
+    a = allocator.allocate_handle(32);
+
+    allocator.reset();
+
+    // the new block starts where the stale one did, so only the epoch tells them apart
+    BlockAllocator::Handle b = allocator.allocate_handle(32);
+    ASSERT_EQ(a.mem, b.mem);
+
+    EXPECT_DEBUG_DEATH(allocator.get(a), "handle used after reset");
+    EXPECT_DEBUG_DEATH(allocator.reallocate(a, 16), "handle used after reset");
+    EXPECT_DEBUG_DEATH(allocator.deallocate(a), "handle used after reset");
+}
+
+TEST(BlockAllocatorTest, Trace)
+{
+    const char *path = "block_allocator_trace.bin";
+
+    BlockAllocator allocator(64, 4);
+    AllocationTrace trace;
+
+    ASSERT_TRUE(trace.open(path));
+    allocator.set_trace(&trace);
+
+    void *a = allocator.allocate(24, 8);
+    void *b = allocator.allocate(128, 8);
+    allocator.deallocate(a);
+
+    allocator.set_trace(0);
+    trace.close();
+
+    std::vector<AllocationTrace::Event> events;
+    ASSERT_TRUE(AllocationTrace::read(path, events));
+    remove(path);
+
+    ASSERT_EQ(events.size(), 3);
+
+    EXPECT_EQ(events[0].operation, AllocationTrace::Operation::Allocate);
+    EXPECT_EQ(events[0].address, reinterpret_cast<uintptr_t>(a));
+    EXPECT_EQ(events[0].size, 24);
+    EXPECT_EQ(events[0].alignment_log2, 3);
+
+    // failed allocations are recorded with a null address
+    EXPECT_FALSE(b);
+    EXPECT_EQ(events[1].address, 0);
+    EXPECT_EQ(events[1].size, 128);
+
+    EXPECT_EQ(events[2].operation, AllocationTrace::Operation::Deallocate);
+    EXPECT_EQ(events[2].address, reinterpret_cast<uintptr_t>(a));
+    EXPECT_LE(events[1].timestamp, events[2].timestamp);
+}
+
+using IntAdapterFixture = AdapterFixture<int>;
+
+TEST(BlockAllocatorTest, Stats)
+{
+    for (BlockAllocator::CoalescePolicy policy :
+         {BlockAllocator::CoalescePolicy::Immediate, BlockAllocator::CoalescePolicy::Deferred})
+    {
+        BlockAllocator a(64 * 1024, 400);
+        a.set_coalesce_policy(policy);
+
+        std::mt19937 random(7);
+        std::vector<std::pair<void *, size_t>> live;
+        size_t bytes_in_use = 0, high_water_mark = 0;
+
+        for (int step = 0; step < 2000; ++step)
+        {
+            if (live.size() && (live.size() > 100 || random() % 2))
+            {
+                size_t i = random() % live.size();
+
+                a.deallocate(live[i].first);
+                bytes_in_use -= live[i].second;
+
+                live[i] = live.back();
+                live.pop_back();
+            }
+            else
+            {
+                size_t size = 1 + random() % 300;
+
+                if (void *mem = a.allocate(size, 1))
+                {
+                    live.push_back({mem, size});
+                    bytes_in_use += size;
+                    high_water_mark = bytes_in_use > high_water_mark ? bytes_in_use : high_water_mark;
+                }
+            }
+
+            if (step % 100 == 99)
+            {
+                a.coalesce();
+            }
+
+            AllocatorStats stats = a.get_stats();
+
+            ASSERT_EQ(stats.capacity, 64 * 1024);
+            ASSERT_EQ(stats.bytes_in_use, bytes_in_use);
+            ASSERT_EQ(stats.free_bytes, 64 * 1024 - bytes_in_use);
+            ASSERT_EQ(stats.high_water_mark, high_water_mark);
+            ASSERT_EQ(stats.largest_free_block, a.get_largest_free_block());
+            ASSERT_EQ(stats.header_capacity, 400);
+            ASSERT_GE(stats.headers_used, a.count_active_headers());
+        }
+
+        a.reset();
+
+        AllocatorStats stats = a.get_stats();
+        EXPECT_EQ(stats.bytes_in_use, 0);
+        EXPECT_EQ(stats.largest_free_block, 64 * 1024);
+        EXPECT_EQ(stats.fragmentation, 0);
+        EXPECT_EQ(stats.high_water_mark, high_water_mark);
+    }
+
+    // an exact fit of the largest free block leaves the next largest one reported
+    BlockAllocator a(1024, 8);
+
+    void *first = a.allocate(512, 1), *second = a.allocate(256, 1), *third = a.allocate(256, 1);
+    a.deallocate(first);
+    a.deallocate(third);
+    ASSERT_EQ(a.allocate(512, 1), first);
+
+    AllocatorStats stats = a.get_stats();
+    EXPECT_EQ(stats.largest_free_block, 256);
+    EXPECT_EQ(stats.fragmentation, 0);
+
+    a.deallocate(second);
+    EXPECT_EQ(a.get_stats().largest_free_block, 512);
+}
+
+TEST(MappedSegmentAllocatorTest, DeallocateArrays)
+{
+    MappedSegmentAllocator a;
+    a.add_chunk(1024);
+
+    int *array = a.allocate<int>(64);
+    ASSERT_TRUE(array);
+    memset(array, 0xAB, 64 * sizeof(int));
+
+    // the whole 256 byte segment is freed and zeroed, not just its first int
+    a.deallocate(array, 64);
+    EXPECT_EQ(a.get_stats().bytes_in_use, 0);
+
+    char *bytes = a.allocate<char>(256);
+    ASSERT_EQ(static_cast<void *>(bytes), static_cast<void *>(array));
+
+    for (size_t i = 0; i < 256; ++i)
+    {
+        ASSERT_EQ(bytes[i], 0);
+    }
+}
+
+TEST(MappedSegmentAllocatorTest, Stats)
+{
+    MappedSegmentAllocator a;
+    a.add_chunk(1024);
+
+    char *first = a.allocate<char>(32), *second = a.allocate<char>(32);
+
+    // the two 32 byte segments share a 64 byte parent, which must not be handed out while either is in use
+    char *third = a.allocate<char>(64);
+    EXPECT_TRUE(third != first && third != second);
+
+    AllocatorStats stats = a.get_stats();
+    EXPECT_EQ(stats.capacity, 1024);
+    EXPECT_EQ(stats.bytes_in_use, 128);
+    EXPECT_EQ(stats.largest_free_block, 512);
+    EXPECT_DOUBLE_EQ(stats.fragmentation, 1 - 512.0 / 896);
+
+    a.deallocate(first, 32);
+    a.deallocate(second, 32);
+    a.deallocate(third, 64);
+
+    stats = a.get_stats();
+    EXPECT_EQ(stats.bytes_in_use, 0);
+    EXPECT_EQ(stats.high_water_mark, 128);
+
+    std::vector<char *> segments;
+    while (char *mem = a.allocate<char>(32))
+    {
+        segments.push_back(mem);
+    }
+
+    EXPECT_EQ(segments.size(), 1024 / 32);
+    EXPECT_EQ(a.get_stats().largest_free_block, 0);
+    EXPECT_FALSE(a.allocate<char>(64));
+
+    a.deallocate(segments.back(), 32);
+    EXPECT_EQ(a.get_stats().largest_free_block, 32);
+}
+
+TEST(BlockAllocatorTest, Dump)
+{
+    const char *path = "block_allocator_dump.csv";
+
+    BlockAllocator a(1024, 10);
+
+    void *first = a.allocate(100, 1);
+    a.allocate(200, 1);
+    a.deallocate(first);
+
+    ASSERT_TRUE(a.dump(path));
+
+    HeapDump dump;
+    ASSERT_TRUE(HeapDump::read(path, dump));
+    remove(path);
+
+    EXPECT_EQ(dump.capacity, 1024);
+    EXPECT_EQ(dump.header_capacity, 10);
+
+    ASSERT_EQ(dump.blocks.size(), 3);
+
+    EXPECT_EQ(dump.blocks[0].offset, 0);
+    EXPECT_EQ(dump.blocks[0].size, 100);
+    EXPECT_TRUE(dump.blocks[0].free);
+
+    EXPECT_EQ(dump.blocks[1].offset, 100);
+    EXPECT_EQ(dump.blocks[1].size, 200);
+    EXPECT_FALSE(dump.blocks[1].free);
+
+    EXPECT_EQ(dump.blocks[2].offset, 300);
+    EXPECT_EQ(dump.blocks[2].size, 724);
+    EXPECT_TRUE(dump.blocks[2].free);
+}
+
+TEST(BlockAllocatorTest, Tags)
+{
+    BlockAllocator a(1024, 20);
+    a.set_coalesce_policy(BlockAllocator::CoalescePolicy::Deferred);
+
+    void *untagged = a.allocate(10, 1), *outer, *inner;
+    {
+        AllocationTagScope scope(1);
+        outer = a.allocate(20, 1);
+        {
+            AllocationTagScope nested(2);
+            inner = a.allocate(30, 1);
+        }
+        a.allocate(40, 1);
+    }
+
+    const TagCounters &counters = a.get_tag_counters();
+
+    EXPECT_EQ(AllocationTagScope::get_current(), 0);
+    EXPECT_EQ(counters.get_live_bytes(0), 10);
+    EXPECT_EQ(counters.get_live_bytes(1), 60);
+    EXPECT_EQ(counters.get_live_count(1), 2);
+    EXPECT_EQ(counters.get_live_bytes(2), 30);
+
+    // tags move with their blocks when headers are inserted and compacted
+    a.deallocate(untagged);
+    a.deallocate(outer);
+    a.coalesce();
+    a.allocate(5, 1);
+
+    EXPECT_EQ(counters.get_live_bytes(0), 5);
+    EXPECT_EQ(counters.get_live_count(1), 1);
+
+    a.deallocate(inner);
+    EXPECT_EQ(counters.get_live_count(2), 0);
+    EXPECT_EQ(counters.get_live_bytes(1), 40);
+
+    const char *path = "block_allocator_tags.csv";
+    ASSERT_TRUE(a.dump(path));
+
+    HeapDump dump;
+    ASSERT_TRUE(HeapDump::read(path, dump));
+    remove(path);
+
+    size_t tagged_bytes = 0;
+    for (const HeapDump::Block &block : dump.blocks)
+    {
+        tagged_bytes += block.tag == 1 ? block.size : 0;
+    }
+
+    EXPECT_EQ(tagged_bytes, 40);
+
+    a.reset();
+    EXPECT_EQ(counters.get_live_bytes(1), 0);
+}
+
+TEST(BlockAllocatorTest, LargeAlignments)
+{
+    BlockAllocator a(4 << 20, 100);
+    a.set_large_allocation_threshold(2 << 20);
+
+    // the arena is only as aligned as malloc made it, so padding follows the address
+    for (size_t alignment = 4096; alignment <= (1 << 20); alignment *= 2)
+    {
+        void *mem = a.allocate(100, alignment);
+        ASSERT_TRUE(mem);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(mem) % alignment, 0);
+        a.deallocate(mem);
+    }
+
+    // mapped with slack, which is unmapped again
+    for (size_t alignment = 4096; alignment <= (16 << 20); alignment *= 4)
+    {
+        char *mem = static_cast<char *>(a.allocate(4 << 20, alignment));
+        ASSERT_TRUE(mem);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(mem) % alignment, 0);
+        EXPECT_LE(a.get_stats().mapped_bytes, (4 << 20) + 4096);
+
+        memset(mem, 1, 4 << 20);
+        a.deallocate(mem);
+    }
+}
+
+TEST(BlockAllocatorTest, LargeAllocations)
+{
+    BlockAllocator a(1024, 20);
+    a.set_large_allocation_threshold(512);
+
+    char *small = static_cast<char *>(a.allocate(100, 8));
+    char *large = static_cast<char *>(a.allocate(1 << 20, 64));
+
+    ASSERT_TRUE(large);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(large) % 64, 0);
+    EXPECT_TRUE(a.owns(small));
+    EXPECT_TRUE(a.owns(large));
+    EXPECT_FALSE(a.owns(&a));
+
+    // mapped allocations take nothing from the arena
+    EXPECT_EQ(a.get_stats().bytes_in_use, 100);
+    EXPECT_GE(a.get_stats().mapped_bytes, 1 << 20);
+    EXPECT_EQ(a.get_tag_counters().get_live_bytes(0), 100 + (1 << 20));
+
+    memset(large, 7, 1 << 20);
+
+    void *other = a.allocate(4096, 8);
+    large = static_cast<char *>(a.reallocate(large, 8 << 20));
+    ASSERT_TRUE(large);
+    EXPECT_EQ(large[0], 7);
+    EXPECT_EQ(large[(1 << 20) - 1], 7);
+    EXPECT_TRUE(a.owns(large));
+    EXPECT_TRUE(a.owns(other));
+
+    // arena blocks are copied
+    memset(small, 3, 100);
+    small = static_cast<char *>(a.reallocate(small, 200));
+    ASSERT_TRUE(small);
+    EXPECT_EQ(small[99], 3);
+    EXPECT_EQ(a.get_stats().bytes_in_use, 200);
+
+    a.deallocate(large);
+    EXPECT_FALSE(a.owns(large));
+    EXPECT_THROW(a.deallocate(large), std::runtime_error);
+
+    a.reset();
+    EXPECT_FALSE(a.owns(other));
+    EXPECT_EQ(a.get_stats().mapped_bytes, 0);
+}
+
+TEST(BlockAllocatorTest, ExternalBuffers)
+{
+    InlineArena<4096, 16> arena;
+    char *mem = static_cast<char *>(arena.allocate(1000, 1));
+
+    EXPECT_GE(mem, reinterpret_cast<char *>(&arena));
+    EXPECT_LT(mem + 1000, reinterpret_cast<char *>(&arena + 1));
+    EXPECT_FALSE(arena.allocate(4000, 1));
+
+    // an arena in a block of another
+    CompactBlockAllocator slice(mem, 512, 8);
+    char *inner = static_cast<char *>(slice.allocate(100));
+    EXPECT_GE(inner, mem);
+    EXPECT_LT(inner, mem + 1000);
+    slice.deallocate(inner);
+    arena.deallocate(mem);
+
+    alignas(std::max_align_t) char buffer[4096];
+
+    LinearAllocator linear(buffer, 256);
+    EXPECT_EQ(linear.allocate<char>(200), buffer);
+    EXPECT_FALSE(linear.allocate<char>(100));
+
+    MappedSegmentAllocator segments;
+    ASSERT_LE(Chunk::get_buffer_size(1024), sizeof(buffer));
+    segments.add_chunk(buffer, 1024);
+    int *value = segments.emplace<int>(5);
+    EXPECT_GE(reinterpret_cast<char *>(value), buffer);
+    EXPECT_LT(reinterpret_cast<char *>(value), buffer + 1024);
+    segments.deallocate(value);
+
+    using StaticAdapter = Adapter<int, InlineArena<64 * 1024>>;
+
+    std::vector<int, StaticAdapter> values(100, 7);
+    EXPECT_TRUE(StaticAdapter::allocator.owns(values.data()));
+}
+
+TEST(BlockAllocatorTest, Budget)
+{
+    BlockAllocator a(4096, 100);
+
+    MemoryBudget budget(1000, 1500);
+    a.set_budget(&budget);
+
+    // a cache that evicts its oldest entry under pressure
+    std::deque<void *> cache;
+    size_t pressure_calls = 0;
+
+    budget.add_pressure_callback([&](size_t bytes_in_use) {
+        ++pressure_calls;
+        EXPECT_GT(bytes_in_use, 1000);
+
+        a.deallocate(cache.front());
+        cache.pop_front();
+    });
+
+    for (int i = 0; i < 10; ++i)
+    {
+        cache.push_back(a.allocate(100, 1));
+    }
+    EXPECT_EQ(budget.get_bytes_in_use(), 1000);
+    EXPECT_EQ(pressure_calls, 0);
+
+    // crossing the soft limit evicts first, then allocates
+    cache.push_back(a.allocate(100, 1));
+    EXPECT_EQ(pressure_calls, 1);
+    EXPECT_EQ(budget.get_bytes_in_use(), 1000);
+
+    // already past it: no callback, and the hard limit holds
+    void *large = a.allocate(400, 1);
+    ASSERT_TRUE(large);
+    EXPECT_EQ(pressure_calls, 2);
+    EXPECT_FALSE(a.allocate(300, 1));
+    EXPECT_EQ(pressure_calls, 2);
+    EXPECT_EQ(budget.get_bytes_in_use(), 1300);
+    EXPECT_EQ(a.get_stats().bytes_in_use, 1300);
+
+    a.deallocate(large);
+    EXPECT_EQ(budget.get_bytes_in_use(), 900);
+
+    a.reset();
+    EXPECT_EQ(budget.get_bytes_in_use(), 0);
+
+    PoolAllocator pool(64);
+    MemoryBudget pool_budget(~size_t(0), 128);
+    pool.set_budget(&pool_budget);
+
+    void *first = pool.allocate();
+    ASSERT_TRUE(first && pool.allocate());
+    EXPECT_FALSE(pool.allocate());
+
+    pool.deallocate(first);
+    EXPECT_TRUE(pool.allocate());
+
+    // the arena's padding counts, as it is used up with the cursor
+    alignas(8) char buffer[256];
+    LinearAllocator linear(buffer, sizeof(buffer));
+    MemoryBudget linear_budget(~size_t(0), 24);
+    linear.set_budget(&linear_budget);
+
+    char *c = linear.allocate<char>();
+    ASSERT_TRUE(c);
+    ASSERT_TRUE(linear.allocate<uint64_t>());
+    EXPECT_EQ(linear_budget.get_bytes_in_use(), 16);
+    EXPECT_FALSE(linear.allocate<uint64_t>(2));
+    EXPECT_EQ(linear_budget.get_bytes_in_use(), 16);
+
+    linear.free(c);
+    EXPECT_EQ(linear_budget.get_bytes_in_use(), 0);
+    EXPECT_TRUE(linear.allocate<uint64_t>(2));
+    linear.reset();
+    EXPECT_EQ(linear_budget.get_bytes_in_use(), 0);
+
+    MappedSegmentAllocator segments;
+    ASSERT_TRUE(segments.add_chunk(4096));
+    MemoryBudget segment_budget(~size_t(0), 200);
+    segments.set_budget(&segment_budget);
+
+    int *ints = segments.allocate<int>(25);
+    ASSERT_TRUE(ints);
+    EXPECT_EQ(segment_budget.get_bytes_in_use(), 100);
+    EXPECT_FALSE(segments.allocate<int>(26));
+    EXPECT_EQ(segment_budget.get_bytes_in_use(), 100);
+
+    segments.deallocate(ints, 25);
+    EXPECT_EQ(segment_budget.get_bytes_in_use(), 0);
+}
+
+#ifdef __linux__
+TEST(BlockAllocatorTest, ReleaseIdleMemory)
+{
+    BlockAllocator a(1 << 20, 100);
+
+    char *head = static_cast<char *>(a.allocate(1024, 1));
+    char *buffer = static_cast<char *>(a.allocate(512 * 1024, 1));
+    memset(buffer, 0xAB, 512 * 1024);
+    a.deallocate(buffer);
+
+    // free at one pass is not yet idle
+    EXPECT_EQ(a.release_idle_memory(1), 0);
+
+    // released from the end of the range, at most 64 KiB at a time
+    size_t released = a.release_idle_memory(1, 64 * 1024);
+    EXPECT_EQ(released, 64 * 1024);
+
+    while (size_t more = a.release_idle_memory(1))
+    {
+        released += more;
+    }
+    EXPECT_GT(released, 1000 * 1024);
+
+    // the pages come back zeroed on reuse
+    buffer = static_cast<char *>(a.allocate(512 * 1024, 1));
+    EXPECT_EQ(buffer[256 * 1024], 0);
+
+    // touched and freed back to the same bounds between passes, the range idles over and is released again
+    memset(buffer, 0xAB, 512 * 1024);
+    a.deallocate(buffer);
+    EXPECT_EQ(a.release_idle_memory(1), 0);
+    EXPECT_GT(a.release_idle_memory(1), 500 * 1024);
+
+    a.deallocate(head);
+}
+
+TEST(ChunkTest, SiblingsKeepParentsInUse)
+{
+    Chunk chunk(1024);
+
+    // the second segment clears its parents' free bits again; toggling them would have marked them free
+    std::vector<std::pair<char *, size_t>> segments;
+    for (size_t size : {32, 32, 64, 64, 128, 256, 512})
+    {
+        if (char *mem = static_cast<char *>(chunk.allocate(size)))
+        {
+            segments.push_back({mem, size});
+        }
+    }
+
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        for (size_t j = i + 1; j < segments.size(); ++j)
+        {
+            EXPECT_TRUE(segments[i].first + segments[i].second <= segments[j].first ||
+                        segments[j].first + segments[j].second <= segments[i].first);
+        }
+    }
+
+    // only the 512 byte segment finds no free half
+    EXPECT_EQ(segments.size(), 6);
+    EXPECT_EQ(chunk.get_free_bytes(), 1024 - 32 * 2 - 64 * 2 - 128 - 256);
+}
+
+TEST(ChunkTest, ReleaseIdleMemory)
+{
+    Chunk chunk(1 << 20);
+
+    char *mem = static_cast<char *>(chunk.allocate(512 * 1024));
+    memset(mem, 0xAB, 512 * 1024);
+    chunk.free(mem, 512 * 1024);
+
+    EXPECT_EQ(chunk.release_if_idle(1, ~size_t(0)), 0);
+    EXPECT_GT(chunk.release_if_idle(1, ~size_t(0)), 500 * 1024);
+    EXPECT_EQ(chunk.release_if_idle(1, ~size_t(0)), 0);
+
+    // reused between passes
+    mem = static_cast<char *>(chunk.allocate(512 * 1024));
+    memset(mem, 0xAB, 512 * 1024);
+    chunk.free(mem, 512 * 1024);
+
+    EXPECT_EQ(chunk.release_if_idle(1, ~size_t(0)), 0);
+    EXPECT_GT(chunk.release_if_idle(1, ~size_t(0)), 500 * 1024);
+
+    // a caller's buffer is never released
+    std::unique_ptr<char[]> buffer(new char[Chunk::get_buffer_size(1 << 16)]);
+    Chunk external(buffer.get(), 1 << 16);
+    for (int pass = 0; pass < 3; ++pass)
+    {
+        EXPECT_EQ(external.release_if_idle(1, ~size_t(0)), 0);
+    }
+}
+
+TEST(MemoryScavengerTest, ReleasesIdleChunks)
+{
+    std::mutex block_mutex, segment_mutex;
+    BlockAllocator blocks(1 << 20, 100);
+    MappedSegmentAllocator segments;
+    segments.add_chunk(256 * 1024);
+
+    void *mem = segments.allocate<char>(4096);
+    segments.deallocate(static_cast<char *>(mem), 4096);
+
+    // passes are made by hand, with the idle time two intervals
+    MemoryScavenger scavenger(std::chrono::hours(1), std::chrono::hours(2));
+    scavenger.add(blocks, block_mutex);
+    scavenger.add(segments, segment_mutex);
+
+    EXPECT_EQ(scavenger.scavenge(), 0);
+    EXPECT_EQ(scavenger.scavenge(), 0);
+
+    size_t released = scavenger.scavenge();
+    EXPECT_GE(released, 1000 * 1024 + 200 * 1024);
+    EXPECT_EQ(scavenger.scavenge(), 0);
+    EXPECT_EQ(scavenger.get_released_bytes(), released);
+
+    // a chunk in use is not idle
+    mem = segments.allocate<char>(64);
+    EXPECT_EQ(segments.release_idle_memory(0), 0);
+    segments.deallocate(static_cast<char *>(mem), 64);
+}
+#endif
+
+TEST(BlockAllocatorTest, RemoteFrees)
+{
+    BlockAllocator a(1024, 20);
+    a.set_owner_thread();
+
+    // blocks hold a list link while queued
+    void *small = a.allocate(1, 1);
+    EXPECT_EQ(a.get_stats().bytes_in_use, sizeof(void *));
+
+    void *blocks[4];
+    for (void *&block : blocks)
+    {
+        block = a.allocate(64, 1);
+    }
+
+    std::thread consumer([&] {
+        for (void *block : blocks)
+        {
+            a.deallocate(block);
+        }
+        a.deallocate(small);
+    });
+    consumer.join();
+
+    // queued until the owner allocates
+    EXPECT_EQ(a.get_stats().bytes_in_use, sizeof(void *) + 4 * 64);
+
+    void *mem = a.allocate(32, 1);
+    EXPECT_EQ(a.get_stats().bytes_in_use, 32);
+    EXPECT_EQ(mem, small);
+
+    // the owner frees directly
+    a.deallocate(mem);
+    EXPECT_EQ(a.get_stats().bytes_in_use, 0);
+}
+
+TEST(AsyncDeallocatorTest, FreesOnWorker)
+{
+    BlockAllocator a(1 << 20, 5000);
+    std::mutex mutex;
+    std::thread::id worker;
+
+    // one queued batch at most, so the threads below wait on the worker
+    AsyncDeallocator deallocator(
+        [&](void *const *mem, size_t count) {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            worker = std::this_thread::get_id();
+            for (size_t i = 0; i < count; ++i)
+            {
+                a.deallocate(mem[i]);
+            }
+        },
+        1);
+
+    auto churn = [&] {
+        for (int i = 0; i < 2000; ++i)
+        {
+            void *mem;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                mem = a.allocate(16);
+            }
+            ASSERT_TRUE(mem);
+
+            deallocator.deallocate(mem);
+        }
+    };
+
+    // the second thread exits with a partial buffer, which is queued when it exits
+    std::thread other(churn);
+    churn();
+    other.join();
+
+    deallocator.flush();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    EXPECT_EQ(a.get_stats().bytes_in_use, 0);
+    EXPECT_NE(worker, std::this_thread::get_id());
+}
+
+TEST(AsyncDeallocatorTest, ThreadsExitingDuringDestruction)
+{
+    constexpr int THREADS = 8;
+
+    for (int round = 0; round < 20; ++round)
+    {
+        std::atomic<size_t> freed{0};
+        std::unique_ptr<AsyncDeallocator> deallocator(
+            new AsyncDeallocator([&](void *const *, size_t count) { freed += count; }));
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        int done = 0;
+        bool exit = false;
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < THREADS; ++i)
+        {
+            threads.emplace_back([&] {
+                int object;
+                deallocator->deallocate(&object);
+
+                std::unique_lock<std::mutex> lock(mutex);
+                ++done;
+                changed.notify_all();
+                changed.wait(lock, [&] { return exit; });
+            });
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return done == THREADS; });
+            exit = true;
+            changed.notify_all();
+        }
+
+        // the threads' buffers are released by their exit and the destructor at the same time
+        deallocator.reset();
+
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
 
-class TestClass
+        EXPECT_EQ(freed, THREADS);
+    }
+}
+
+TEST(AsyncDeallocatorTest, SeveralPerThread)
 {
-  public:
-    TestClass(bool &alive, int a, int b, int c) : alive(alive), a(a), b(b), c(c)
+    constexpr size_t COUNT = AsyncDeallocator::THREAD_BUFFERS + 1;
+
+    std::vector<size_t> batch_sizes[COUNT], freed(COUNT);
+    std::vector<std::unique_ptr<AsyncDeallocator>> deallocators;
+
+    for (size_t i = 0; i < COUNT; ++i)
     {
-        alive = true;
+        deallocators.emplace_back(new AsyncDeallocator([&, i](void *const *mem, size_t count) {
+            batch_sizes[i].push_back(count);
+            freed[i] += count;
+        }));
     }
 
-    ~TestClass()
+    // alternating between deallocators a thread has buffers for fills whole batches
+    int object;
+    for (size_t i = 0; i < AsyncDeallocator::BATCH_SIZE * 2; ++i)
     {
-        alive = false;
+        deallocators[i % 2]->deallocate(&object);
     }
+    deallocators[0]->flush();
+    deallocators[1]->flush();
 
-    int a, b, c;
+    EXPECT_EQ(batch_sizes[0], std::vector<size_t>{AsyncDeallocator::BATCH_SIZE});
+    EXPECT_EQ(batch_sizes[1], std::vector<size_t>{AsyncDeallocator::BATCH_SIZE});
 
-    bool &alive;
-};
+    // one more than that still frees everything
+    for (size_t i = 0; i < COUNT * 100; ++i)
+    {
+        deallocators[i % COUNT]->deallocate(&object);
+    }
+    for (std::unique_ptr<AsyncDeallocator> &deallocator : deallocators)
+    {
+        deallocator->flush();
+    }
 
-TEST(BlockAllocatorTest, Allocate)
+    EXPECT_EQ(freed[0], AsyncDeallocator::BATCH_SIZE + 100);
+    EXPECT_EQ(freed[COUNT - 1], 100);
+}
+
+TEST(EpochReclaimerTest, FreesAfterReaders)
 {
-    constexpr size_t size = sizeof(int);
+    BlockAllocator a(1024, 20);
+    EpochReclaimer reclaimer(100);
 
-    BlockAllocator allocator(size * 2, 2);
+    {
+        EpochReclaimer::Guard guard(reclaimer);
 
-    int *a = static_cast<int *>(allocator.allocate(size, alignof(int)));
-    ASSERT_TRUE(a);
+        reclaimer.retire(a, a.allocate(64));
 
-    int *b = static_cast<int *>(allocator.allocate(size, alignof(int)));
-    ASSERT_TRUE(b);
+        // the guard announced the retiring epoch, which may end, but the next must wait for the guard
+        reclaimer.collect();
+        reclaimer.collect();
+        EXPECT_EQ(reclaimer.get_pending_count(), 1);
+        EXPECT_EQ(a.get_stats().bytes_in_use, 64);
+    }
 
-    ASSERT_NE(a, b);
+    EXPECT_EQ(reclaimer.collect(), 1);
+    EXPECT_EQ(a.get_stats().bytes_in_use, 0);
+
+    // a reader on another thread holds back blocks retired here
+    std::mutex mutex;
+    std::condition_variable changed;
+    int stage = 0;
+
+    std::thread reader([&] {
+        EpochReclaimer::Guard guard(reclaimer);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        stage = 1;
+        changed.notify_all();
+        changed.wait(lock, [&] { return stage == 2; });
+    });
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return stage == 1; });
+    }
+
+    reclaimer.retire(a, a.allocate(64));
+    reclaimer.collect();
+    reclaimer.collect();
+    EXPECT_EQ(reclaimer.get_pending_count(), 1);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stage = 2;
+        changed.notify_all();
+    }
+    reader.join();
+
+    reclaimer.collect();
+    reclaimer.collect();
+    EXPECT_EQ(reclaimer.get_pending_count(), 0);
+    EXPECT_EQ(a.get_stats().bytes_in_use, 0);
 }
 
-TEST(BlockAllocatorTest, OverAllocate)
+TEST(EpochReclaimerTest, ExitedThreadsAndDestructors)
 {
-    constexpr size_t size = sizeof(int);
+    MappedSegmentAllocator a;
+    a.add_chunk(1024);
 
-    BlockAllocator allocator(size, 1);
+    EpochReclaimer reclaimer;
+    bool alive = false;
 
-    int *a = static_cast<int *>(allocator.allocate(size, alignof(int)));
-    ASSERT_TRUE(a);
+    // blocks left by an exited thread are freed by the next thread to collect, running the destructor
+    std::thread([&] { reclaimer.retire(a, a.emplace<TestClass>(alive, 1, 2, 3)); }).join();
+    EXPECT_TRUE(alive);
+    EXPECT_EQ(reclaimer.get_pending_count(), 1);
 
-    int *b = static_cast<int *>(allocator.allocate(size, alignof(int)));
-    ASSERT_FALSE(b);
+    reclaimer.collect();
+    reclaimer.collect();
+    EXPECT_FALSE(alive);
+    EXPECT_EQ(a.get_stats().bytes_in_use, 0);
 }
 
-TEST(BlockAllocatorTest, Deallocate)
+TEST(EpochReclaimerTest, NestedGuardsOnSeveralReclaimers)
 {
-    constexpr size_t size = sizeof(int);
+    BlockAllocator a(1024, 20);
+    EpochReclaimer outer, inner;
 
-    BlockAllocator allocator(size * 2, 2);
+    {
+        EpochReclaimer::Guard guard(outer);
 
-    int *a = static_cast<int *>(allocator.allocate(size, alignof(int)));
-    ASSERT_TRUE(a);
+        outer.retire(a, a.allocate(64));
 
-    int *b = static_cast<int *>(allocator.allocate(size, alignof(int)));
-    ASSERT_TRUE(b);
+        {
+            EpochReclaimer::Guard inner_guard(inner);
+            inner.retire(a, a.allocate(64));
+        }
 
-    allocator.deallocate(b);
-    allocator.deallocate(a);
+        // the inner guard must not have cleared the outer one's announcement
+        outer.collect();
+        outer.collect();
+        EXPECT_EQ(outer.get_pending_count(), 1);
+        EXPECT_EQ(a.get_stats().bytes_in_use, 128);
 
-    int *c = static_cast<int *>(allocator.allocate(size, alignof(int)));
-    ASSERT_EQ(a, c);
+        inner.collect();
+        inner.collect();
+        EXPECT_EQ(inner.get_pending_count(), 0);
+    }
 
-    int *d = static_cast<int *>(allocator.allocate(size, alignof(int)));
-    ASSERT_EQ(b, d);
+    outer.collect();
+    outer.collect();
+    EXPECT_EQ(outer.get_pending_count(), 0);
+    EXPECT_EQ(a.get_stats().bytes_in_use, 0);
+
+    // unguarded reclaimers give up their slots to new ones; guarded ones never do
+    EpochReclaimer reclaimers[EpochReclaimer::THREAD_RECLAIMERS + 1];
+    std::vector<std::unique_ptr<EpochReclaimer::Guard>> guards;
+
+    for (size_t i = 0; i < EpochReclaimer::THREAD_RECLAIMERS; ++i)
+    {
+        guards.emplace_back(new EpochReclaimer::Guard(reclaimers[i]));
+    }
+
+    EXPECT_THROW(EpochReclaimer::Guard guard(reclaimers[EpochReclaimer::THREAD_RECLAIMERS]), std::runtime_error);
+
+    guards.pop_back();
+    EpochReclaimer::Guard guard(reclaimers[EpochReclaimer::THREAD_RECLAIMERS]);
 }
 
-using IntAdapterFixture = AdapterFixture<int>;
+TEST(SharedBlockAllocatorTest, AttachAtAnotherAddress)
+{
+    using SharedVector = std::vector<int, Adapter<int, SharedBlockAllocator, 1>>;
+
+    SharedBlockAllocator &owner = AllocatorGroup<SharedBlockAllocator, 1>::allocator;
+    ASSERT_TRUE(owner.create(0, 1 << 16, 100));
+
+    SharedVector *table = new (owner.allocate(sizeof(SharedVector))) SharedVector;
+    for (int i = 0; i < 1000; ++i)
+    {
+        table->push_back(i);
+    }
+    owner.set_root(table);
+
+    // a second mapping of the same memory, as another process would see it
+    SharedBlockAllocator reader;
+    ASSERT_TRUE(reader.attach(owner.get_fd()));
+    ASSERT_NE(reader.get_root(), owner.get_root());
+
+    const SharedVector &view = *static_cast<SharedVector *>(reader.get_root());
+    ASSERT_EQ(view.size(), 1000);
+    EXPECT_EQ(view[999], 999);
+    EXPECT_TRUE(reader.owns(view.data()));
+    EXPECT_FALSE(owner.owns(view.data()));
+
+    // both mappings allocate from the same arena
+    size_t in_use = owner.get_stats().bytes_in_use;
+    void *mem = reader.allocate(100);
+    EXPECT_EQ(owner.get_stats().bytes_in_use, in_use + 100);
+    reader.deallocate(mem);
+
+    table->~SharedVector();
+    owner.deallocate(table);
+    EXPECT_EQ(reader.get_stats().bytes_in_use, 0);
+
+    owner.detach();
+}
+
+TEST(SharedBlockAllocatorTest, OwnerDeath)
+{
+    SharedBlockAllocator shared;
+    ASSERT_TRUE(shared.create(0, 1 << 16, 100));
+
+    void *mem = shared.allocate(100);
+    ASSERT_TRUE(mem);
+    EXPECT_FALSE(shared.is_poisoned());
+
+    pid_t child = fork();
+    if (!child)
+    {
+        shared.abandon_lock();
+        _exit(0);
+    }
+
+    int status;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+
+    // the child may have left the headers half updated
+    EXPECT_TRUE(shared.is_poisoned());
+    EXPECT_FALSE(shared.allocate(100));
+    shared.deallocate(mem);
+    EXPECT_EQ(shared.get_stats().bytes_in_use, 100);
+
+    // and other processes see it too
+    SharedBlockAllocator other;
+    ASSERT_TRUE(other.attach(shared.get_fd()));
+    EXPECT_TRUE(other.is_poisoned());
+    EXPECT_FALSE(other.allocate(100));
+}
+
+TEST(SharedBlockAllocatorTest, PersistentFile)
+{
+    using PersistentVector = std::vector<int, Adapter<int, SharedBlockAllocator, 2>>;
+
+    const char *path = "shared_block_allocator.arena";
+    remove(path);
+
+    SharedBlockAllocator &arena = AllocatorGroup<SharedBlockAllocator, 2>::allocator;
+    ASSERT_TRUE(arena.open(path, 1 << 16, 100));
+
+    PersistentVector *table = new (arena.allocate(sizeof(PersistentVector))) PersistentVector(100, 7);
+    arena.set_root(table);
+    ASSERT_TRUE(arena.sync());
+
+    size_t in_use = arena.get_stats().bytes_in_use;
+    arena.detach();
+
+    // as after a restart; the sizes passed are only used for a new file
+    ASSERT_TRUE(arena.open(path, 0, 1));
+    EXPECT_EQ(arena.get_stats().bytes_in_use, in_use);
+
+    table = static_cast<PersistentVector *>(arena.get_root());
+    ASSERT_EQ(table->size(), 100);
+    EXPECT_EQ((*table)[99], 7);
+
+    table->push_back(8);
+    EXPECT_TRUE(arena.owns(table->data()));
+
+    // opened again while mapped, the file is shared as it is
+    SharedBlockAllocator second;
+    ASSERT_TRUE(second.open(path, 0, 1));
+    void *mem = second.allocate(100);
+    EXPECT_EQ(arena.get_stats().bytes_in_use, second.get_stats().bytes_in_use);
+    second.deallocate(mem);
+    second.detach();
+
+    arena.detach();
+    remove(path);
+
+    // files holding anything else are left alone
+    FILE *file = fopen(path, "w");
+    fputs("not an arena", file);
+    fclose(file);
+
+    EXPECT_FALSE(arena.open(path, 1 << 16, 100));
+    remove(path);
+
+    // a process died initializing the file: after sizing it, or before storing the magic
+    for (bool constructed : {false, true})
+    {
+        if (constructed)
+        {
+            ASSERT_TRUE(arena.open(path, 1 << 16, 100));
+            arena.detach();
+        }
+
+        int fd = ::open(path, O_RDWR | O_CREAT, 0600);
+        ASSERT_GE(fd, 0);
+
+        if (constructed)
+        {
+            uint64_t magic = 0;
+            ASSERT_EQ(pwrite(fd, &magic, sizeof(magic), 0), sizeof(magic));
+        }
+        else
+        {
+            ASSERT_EQ(ftruncate(fd, 1 << 20), 0);
+        }
+        close(fd);
+
+        ASSERT_TRUE(arena.open(path, 1 << 16, 100));
+        EXPECT_FALSE(arena.get_root());
+        EXPECT_TRUE(arena.allocate(100));
+        arena.detach();
+        remove(path);
+    }
+}
+
+TEST(MappedSegmentAllocatorTest, Dump)
+{
+    const char *path = "mapped_segment_allocator_dump.csv";
+
+    MappedSegmentAllocator a;
+    a.add_chunk(128);
+    a.allocate<char>(32);
+
+    ASSERT_TRUE(a.dump(path));
+
+    HeapDump dump;
+    ASSERT_TRUE(HeapDump::read(path, dump));
+    remove(path);
+
+    EXPECT_EQ(dump.capacity, 128);
+    ASSERT_EQ(dump.chunk_sizes.size(), 1);
+
+    // 32, 64 and 128 byte segments; everything above the allocated segment is taken
+    ASSERT_EQ(dump.orders.size(), 3);
+    EXPECT_EQ(dump.orders[0].segment_size, 32);
+    EXPECT_EQ(dump.orders[0].free_segments, 3);
+    EXPECT_EQ(dump.orders[0].segment_count, 4);
+    EXPECT_EQ(dump.orders[1].free_segments, 1);
+    EXPECT_EQ(dump.orders[2].free_segments, 0);
+}
+
+// the sanitizers must come first in the library list, so they cannot run with another malloc preloaded
+#if defined(MEM_ALLOC_PRELOAD) && !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+// run by RunsUnmodifiedPrograms under the preload library, too
+TEST(PreloadTest, Alignments)
+{
+    for (size_t alignment = sizeof(void *); alignment <= (4 << 20); alignment *= 2)
+    {
+        for (size_t size : {size_t(1), size_t(100), alignment, size_t(4 << 20)})
+        {
+            void *mem = 0;
+            ASSERT_EQ(posix_memalign(&mem, alignment, size), 0);
+            EXPECT_EQ(reinterpret_cast<uintptr_t>(mem) % alignment, 0) << alignment << " " << size;
+
+            memset(mem, 1, size);
+            free(mem);
+        }
+    }
+}
+
+TEST(PreloadTest, RunsUnmodifiedPrograms)
+{
+    char self[4096] = {};
+    ASSERT_GT(readlink("/proc/self/exe", self, sizeof(self) - 1), 0);
+
+    // the containers and threads of other tests, with every allocation going through the preload library
+    std::string command = std::string("LD_PRELOAD=") + MEM_ALLOC_PRELOAD + " " + self +
+                          " --gtest_filter='IntAdapterFixture.*:AsyncDeallocatorTest.*:EpochReclaimerTest.*:PreloadTest.Alignments' > /dev/null";
+    EXPECT_EQ(std::system(command.c_str()), 0);
+
+    command = std::string("printf 'b\\na\\n' | LD_PRELOAD=") + MEM_ALLOC_PRELOAD + " sort | tr -d '\\n'";
+
+    FILE *output = popen(command.c_str(), "r");
+    ASSERT_TRUE(output);
+
+    char sorted[16] = {};
+    EXPECT_TRUE(fgets(sorted, sizeof(sorted), output));
+    EXPECT_EQ(pclose(output), 0);
+    EXPECT_STREQ(sorted, "ab");
+}
+#endif
+
+TEST(AllocationSamplerTest, SampledLiveSet)
+{
+    const char *path = "allocation_sampler.heap";
+
+    // an interval of 0 samples every allocation
+    AllocationSampler sampler(0);
+
+    BlockAllocator a(1024, 10);
+    a.set_sampler(&sampler);
+
+    void *first = a.allocate(100);
+    a.allocate(200);
+    a.deallocate(first);
+
+    EXPECT_EQ(sampler.get_sample_count(), 1);
+
+    ASSERT_TRUE(sampler.write_heap_profile(path));
+
+    FILE *file = fopen(path, "r");
+    ASSERT_TRUE(file);
+
+    char line[256] = {};
+    ASSERT_TRUE(fgets(line, sizeof(line), file));
+    fclose(file);
+    remove(path);
+
+    EXPECT_STREQ(line, "heap profile: 1: 200 [2: 300] @ heap_v2/0\n");
+}
+
+TEST(AllocationSamplerTest, SamplingRate)
+{
+    AllocationSampler sampler(4096);
+
+    // 4 MiB in 64 byte allocations: about 1024 samples
+    std::vector<char> arena(4 * 1024 * 1024);
+    for (size_t offset = 0; offset < arena.size(); offset += 64)
+    {
+        sampler.record_allocate(&arena[offset], 64);
+    }
+
+    EXPECT_GT(sampler.get_sample_count(), 900);
+    EXPECT_LT(sampler.get_sample_count(), 1150);
+}
+
+TEST(LatencyHistogramTest, Percentiles)
+{
+    LatencyHistogram histogram;
+
+    EXPECT_EQ(histogram.get_percentile(50), 0);
+
+    for (uint64_t ns = 1; ns <= 1000; ++ns)
+    {
+        histogram.record(ns);
+    }
+
+    EXPECT_EQ(histogram.get_count(), 1000);
+    EXPECT_EQ(histogram.get_max(), 1000);
+
+    // buckets are at most 25% wide, and never report past the maximum
+    EXPECT_GE(histogram.get_percentile(50), 500);
+    EXPECT_LE(histogram.get_percentile(50), 625);
+    EXPECT_GE(histogram.get_percentile(99), 990);
+    EXPECT_EQ(histogram.get_percentile(99.9), 1000);
+    EXPECT_EQ(histogram.get_percentile(100), 1000);
+
+    // small values are exact
+    LatencyHistogram small;
+    small.record(3);
+    small.record(2);
+    EXPECT_EQ(small.get_percentile(50), 2);
+
+    histogram.merge(small);
+    EXPECT_EQ(histogram.get_count(), 1002);
+    EXPECT_EQ(histogram.get_percentile(0.1), 2);
+
+    histogram.clear();
+    EXPECT_EQ(histogram.get_count(), 0);
+    EXPECT_EQ(histogram.get_max(), 0);
+}
+
+#ifdef LATENCY_HISTOGRAMS
+TEST(BlockAllocatorTest, Latency)
+{
+    BlockAllocator a(1024, 10);
+
+    LatencyStats before = LatencyStats::get_thread();
+
+    void *mem = a.allocate(64);
+    a.deallocate(mem);
+    a.coalesce();
+
+    EXPECT_EQ(a.get_latency().allocate.get_count(), 1);
+    EXPECT_EQ(a.get_latency().deallocate.get_count(), 1);
+    EXPECT_EQ(a.get_latency().coalesce.get_count(), 1);
+
+    EXPECT_EQ(LatencyStats::get_thread().allocate.get_count(), before.allocate.get_count() + 1);
+}
+#endif
 
 TEST_F(IntAdapterFixture, VectorAllocation)
 {
@@ -492,6 +1850,56 @@ TEST_F(IntAdapterFixture, FragmentationPreventsLargeAlloc)
     EXPECT_THROW(adapter.allocate(2), std::bad_alloc) << "Should fail due to fragmentation";
 }
 
+TEST_F(IntAdapterFixture, DeferredCoalescing)
+{
+    init(sizeof(int) * 3, 3);
+    A::allocator.set_coalesce_policy(BlockAllocator::CoalescePolicy::Deferred);
+
+    int *p1 = adapter.allocate(1);
+    int *p2 = adapter.allocate(1);
+    int *p3 = adapter.allocate(1);
+
+    adapter.deallocate(p1, 1);
+    adapter.deallocate(p2, 1);
+    adapter.deallocate(p3, 1);
+
+    // freed blocks stay split and are reused as they are
+    EXPECT_EQ(A::allocator.count_free_blocks(), 3);
+    EXPECT_EQ(adapter.allocate(1), p1);
+    adapter.deallocate(p1, 1);
+
+    // no single block fits, so the allocation coalesces and retries
+    int *p4 = adapter.allocate(3);
+    EXPECT_EQ(p4, p1);
+    adapter.deallocate(p4, 3);
+
+    EXPECT_EQ(A::allocator.count_free_blocks(), 1);
+}
+
+TEST_F(IntAdapterFixture, BoundedCoalesce)
+{
+    init(sizeof(int) * 4, 4);
+    A::allocator.set_coalesce_policy(BlockAllocator::CoalescePolicy::Deferred);
+
+    int *p[4];
+    for (int *&mem : p)
+    {
+        mem = adapter.allocate(1);
+    }
+
+    for (int *mem : p)
+    {
+        adapter.deallocate(mem, 1);
+    }
+
+    EXPECT_EQ(A::allocator.coalesce(1), 1);
+    EXPECT_EQ(A::allocator.count_free_blocks(), 3);
+
+    EXPECT_EQ(A::allocator.coalesce(), 2);
+    EXPECT_EQ(A::allocator.count_free_blocks(), 1);
+    EXPECT_EQ(A::allocator.get_largest_free_block(), sizeof(int) * 4);
+}
+
 TEST_F(IntAdapterFixture, HeaderReuseAfterCoalescing)
 {
     init(sizeof(int) * 2, 3);
@@ -652,116 +2060,127 @@ TEST_F(IntAdapterFixture, NestedUnorderedMaps)
     }
 }
 
-using StringAdapterFixture = AdapterFixture<std::string>;
-
-TEST_F(StringAdapterFixture, EmplaceAndRemove)
+TEST(PoolAllocatorTest, ReuseFreedBlock)
 {
-    init(sizeof(std::string), 1);
+    PoolAllocator pool(sizeof(int), alignof(int), 4);
 
-    std::string *s = A::emplace("hi");
+    void *a = pool.allocate();
+    ASSERT_TRUE(a);
 
-    ASSERT_TRUE(!!s);
+    void *b = pool.allocate();
+    ASSERT_TRUE(b);
 
-    ASSERT_EQ(*s, std::string("hi"));
+    ASSERT_NE(a, b);
 
-    A::remove(s);
-}
+    pool.deallocate(a);
 
-#ifdef _MSC_VER
-#define PREVENT_OPTIMIZATION(data)                                                                                     \
-    {                                                                                                                  \
-        _ReadWriteBarrier();                                                                                           \
-        (void)data;                                                                                                    \
-    }
-#else
-#define PREVENT_OPTIMIZATION(data)                                                                                     \
-    {                                                                                                                  \
-        asm volatile("" : : "g"(data) : "memory");                                                                     \
-    }
-#endif
+    EXPECT_EQ(pool.allocate(), a);
+}
 
-TEST_F(IntAdapterFixture, BenchmarkSmallAllocations)
+TEST(PoolAllocatorTest, GrowAcrossSlabs)
 {
-    const int iterations = 100000;
+    PoolAllocator pool(sizeof(HeavyType), alignof(HeavyType), 4);
 
-    // --- Custom allocator ---
-    init(iterations * sizeof(int) * 2, 50);
-    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<void *> blocks;
 
-    for (int i = 0; i < iterations; ++i)
+    for (int i = 0; i < 10; ++i)
     {
-        std::vector<int, A> v;
-        v.push_back(i);
-        PREVENT_OPTIMIZATION(v.data());
-    }
+        void *mem = pool.allocate();
+        ASSERT_TRUE(mem);
 
-    auto custom_time = std::chrono::high_resolution_clock::now() - start;
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(mem) % alignof(HeavyType), 0) << "Alignment broken at index " << i;
 
-    init(1, 1); // free memory without calling destructor
+        for (void *other : blocks)
+        {
+            ASSERT_NE(mem, other);
+        }
 
-    // --- Standard Allocator ---
-    start = std::chrono::high_resolution_clock::now();
+        blocks.push_back(mem);
+    }
 
-    for (int i = 0; i < iterations; ++i)
+    for (void *mem : blocks)
     {
-        std::vector<int> v;
-        v.push_back(i);
-        PREVENT_OPTIMIZATION(v.data());
+        pool.deallocate(mem);
     }
+}
 
-    auto default_time = std::chrono::high_resolution_clock::now() - start;
+TEST(PoolAllocatorTest, Stats)
+{
+    PoolAllocator pool(24, 8, 4);
+
+    std::vector<void *> blocks;
+    for (int i = 0; i < 5; ++i)
+    {
+        blocks.push_back(pool.allocate());
+    }
 
-    auto custom_ms = std::chrono::duration_cast<std::chrono::microseconds>(custom_time).count();
-    auto default_ms = std::chrono::duration_cast<std::chrono::microseconds>(default_time).count();
+    pool.deallocate(blocks.back());
 
-    std::cout << "Custom allocator:  " << custom_ms << " us\n";
-    std::cout << "Default Allocator: " << default_ms << " us\n";
-    std::cout << "Ratio:             " << custom_ms / (double)default_ms << "x\n";
+    AllocatorStats stats = pool.get_stats();
+    EXPECT_EQ(stats.capacity, 2 * 4 * 24);
+    EXPECT_EQ(stats.bytes_in_use, 4 * 24);
+    EXPECT_EQ(stats.free_bytes, 4 * 24);
+    EXPECT_EQ(stats.largest_free_block, 24);
+    EXPECT_EQ(stats.high_water_mark, 5 * 24);
+    EXPECT_EQ(stats.fragmentation, 0);
 }
 
-TEST_F(IntAdapterFixture, BenchmarkTypicalAllocations)
+TEST_F(IntAdapterFixture, PoolAdapterNodeContainers)
 {
-    const int iterations = 100000;
+    init(50000, 200);
 
-    // --- Custom allocator ---
-    init(iterations * sizeof(int) * 3, 50);
-    auto start = std::chrono::high_resolution_clock::now();
+    using PoolMap = std::map<int, int, std::less<int>, Adapter<std::pair<const int, int>, PoolAllocator>>;
+    using PoolUnorderedMap = std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                                                Adapter<std::pair<const int, int>, PoolAllocator>>;
 
-    for (size_t i = 0; i < 10; ++i)
     {
-        std::vector<int, A> v;
+        PoolMap map;
 
-        for (int i = 0; i < iterations; ++i)
+        for (int i = 0; i < 200; ++i)
         {
-            v.push_back(i);
-            PREVENT_OPTIMIZATION(v.data());
+            map[i] = i * 2;
         }
-    }
 
-    auto custom_time = std::chrono::high_resolution_clock::now() - start;
+        for (int i = 0; i < 200; i += 2)
+        {
+            map.erase(i);
+        }
 
-    init(1, 1); // free memory without calling destructor
+        ASSERT_EQ(map.size(), 100);
+        EXPECT_EQ(map[51], 102);
 
-    // --- Default Allocator: ---
-    start = std::chrono::high_resolution_clock::now();
+        // tree nodes never touch the BlockAllocator
+        EXPECT_EQ(A::allocator.count_active_headers(), 1);
+    }
 
-    for (size_t i = 0; i < 10; ++i)
     {
-        std::vector<int> v;
+        PoolUnorderedMap map;
 
-        for (int i = 0; i < iterations; ++i)
+        for (int i = 0; i < 200; ++i)
         {
-            v.push_back(i);
-            PREVENT_OPTIMIZATION(v.data());
+            map[i] = i * 3;
         }
+
+        ASSERT_EQ(map.size(), 200);
+        EXPECT_EQ(map[77], 231);
     }
 
-    auto default_time = std::chrono::high_resolution_clock::now() - start;
+    // bucket arrays went through the BlockAllocator and were returned
+    EXPECT_EQ(A::allocator.count_free_blocks(), 1);
+    EXPECT_EQ(A::allocator.get_largest_free_block(), 50000);
+}
+
+using StringAdapterFixture = AdapterFixture<std::string>;
+
+TEST_F(StringAdapterFixture, EmplaceAndRemove)
+{
+    init(sizeof(std::string), 1);
+
+    std::string *s = A::emplace("hi");
+
+    ASSERT_TRUE(!!s);
 
-    auto custom_ms = std::chrono::duration_cast<std::chrono::microseconds>(custom_time).count();
-    auto default_ms = std::chrono::duration_cast<std::chrono::microseconds>(default_time).count();
+    ASSERT_EQ(*s, std::string("hi"));
 
-    std::cout << "Custom allocator:  " << custom_ms << " us\n";
-    std::cout << "Default Allocator: " << default_ms << " us\n";
-    std::cout << "Ratio:             " << custom_ms / (double)default_ms << "x\n";
+    A::remove(s);
 }
@@ -0,0 +1,168 @@
+// Renders a heap dump as an address-space strip and a histogram of free block sizes, to show why large requests
+// fail: free memory split into many small blocks leaves the largest free block far below the free total.
+//
+// usage: mem_alloc_heapmap <dump> [--width COLUMNS]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "memory_allocator/HeapDump.h"
+
+static std::string bar(size_t value, size_t max, size_t width)
+{
+    return std::string(max ? (value * width + max - 1) / max : 0, '#');
+}
+
+// one character per slice of the arena: ' ' all free, '#' all used, '+' partly used
+static void print_strip(const HeapDump &dump, size_t width)
+{
+    if (!dump.capacity)
+    {
+        return;
+    }
+
+    std::vector<double> used(width);
+    double slice = double(dump.capacity) / width;
+
+    for (const HeapDump::Block &block : dump.blocks)
+    {
+        if (block.free)
+        {
+            continue;
+        }
+
+        double begin = block.offset, end = double(block.offset + block.size);
+
+        for (size_t column = size_t(begin / slice); column < width && column * slice < end; ++column)
+        {
+            double overlap_begin = begin > column * slice ? begin : column * slice;
+            double overlap_end = end < (column + 1) * slice ? end : (column + 1) * slice;
+
+            used[column] += (overlap_end - overlap_begin) / slice;
+        }
+    }
+
+    printf("address space (%.0f bytes per column):\n|", slice);
+    for (double share : used)
+    {
+        putchar(share <= 0 ? ' ' : share >= 0.999 ? '#' : '+');
+    }
+    printf("|\n\n");
+}
+
+static void print_blocks(const HeapDump &dump, size_t width)
+{
+    size_t used_bytes = 0, free_bytes = 0, largest_free = 0, free_count = 0;
+
+    // free blocks by power of two size class: counts and bytes
+    std::vector<size_t> counts(64), bytes(64);
+    std::map<uint32_t, size_t> tag_bytes;
+
+    for (const HeapDump::Block &block : dump.blocks)
+    {
+        if (!block.free)
+        {
+            used_bytes += block.size;
+            tag_bytes[block.tag] += block.size;
+            continue;
+        }
+
+        size_t size_class = 63 - __builtin_clzll(block.size | 1);
+
+        ++counts[size_class];
+        bytes[size_class] += block.size;
+
+        free_bytes += block.size;
+        largest_free = block.size > largest_free ? block.size : largest_free;
+        ++free_count;
+    }
+
+    printf("capacity:           %zu bytes\n", dump.capacity);
+    printf("used:               %zu bytes in %zu blocks\n", used_bytes, dump.blocks.size() - free_count);
+    printf("free:               %zu bytes in %zu blocks\n", free_bytes, free_count);
+    printf("largest free block: %zu bytes\n", largest_free);
+    printf("fragmentation:      %.3f\n", free_bytes ? 1 - double(largest_free) / free_bytes : 0);
+    printf("headers:            %zu of %zu\n\n", dump.headers_used, dump.header_capacity);
+
+    print_strip(dump, width);
+
+    size_t max_bytes = 0;
+    for (size_t total : bytes)
+    {
+        max_bytes = total > max_bytes ? total : max_bytes;
+    }
+
+    printf("free bytes by block size:\n");
+    for (size_t size_class = 0; size_class < 64; ++size_class)
+    {
+        if (counts[size_class])
+        {
+            printf("  %10zu+ %8zu blocks %12zu bytes %s\n", size_t(1) << size_class, counts[size_class],
+                   bytes[size_class], bar(bytes[size_class], max_bytes, width / 2).c_str());
+        }
+    }
+
+    printf("\nused bytes by tag:\n");
+    for (const auto &[tag, tagged_bytes] : tag_bytes)
+    {
+        printf("  %10u %12zu bytes %s\n", tag, tagged_bytes, bar(tagged_bytes, used_bytes, width / 2).c_str());
+    }
+}
+
+static void print_orders(const HeapDump &dump, size_t width)
+{
+    printf("capacity:           %zu bytes in %zu chunks\n", dump.capacity, dump.chunk_sizes.size());
+
+    size_t chunk = ~size_t(0);
+
+    for (const HeapDump::Order &order : dump.orders)
+    {
+        if (order.chunk != chunk)
+        {
+            chunk = order.chunk;
+            printf("\nchunk %zu (%zu bytes), free segments by size:\n", chunk, dump.chunk_sizes[chunk]);
+        }
+
+        printf("  %10zu %8zu of %-8zu %s\n", order.segment_size, order.free_segments, order.segment_count,
+               bar(order.free_segments, order.segment_count, width / 2).c_str());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t width = 100;
+
+    if (argc == 4 && !strcmp(argv[2], "--width"))
+    {
+        width = strtoull(argv[3], 0, 10);
+    }
+
+    if ((argc != 2 && argc != 4) || !width)
+    {
+        fprintf(stderr, "usage: %s <dump> [--width COLUMNS]\n", argv[0]);
+        return 2;
+    }
+
+    HeapDump dump;
+
+    if (!HeapDump::read(argv[1], dump))
+    {
+        fprintf(stderr, "%s: cannot read heap dump %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    if (dump.orders.size())
+    {
+        print_orders(dump, width);
+    }
+    else
+    {
+        print_blocks(dump, width);
+    }
+
+    return 0;
+}
@@ -0,0 +1,668 @@
+// Replaces malloc and global operator new in an unmodified program:
+//
+//     LD_PRELOAD=libmem_alloc_preload.so ./program
+//
+// Small requests are served from power-of-two segments of a MappedSegmentAllocator and the rest from a BlockAllocator,
+// whose requests of LARGE_THRESHOLD and up are mapped directly. Each source has its own lock. Every allocation is
+// preceded by a Header recording its source and size, which free, realloc and malloc_usable_size read back.
+//
+// Neither allocator is built for a whole program's heap: a segment is found by scanning the chunk's bitmap, and a block
+// by a first-fit walk over up to MAX_BLOCK_COUNT headers. Requests of up to CACHED_LIMIT bytes are therefore rounded up
+// to a power of two, and freed ones are kept on a free list per size and source, up to MAX_CACHED_BYTES each, for the
+// next request of that size. Programs whose heap is mostly larger blocks, or that free more than the lists keep, still
+// pay for the walks, and even a compiler runs about twice as long as with glibc malloc.
+//
+// All memory comes from mmap, so the allocators never call the malloc they replace. Calls made before the allocators
+// are set up, including the allocators' own, are served from a static bootstrap buffer whose blocks are never freed.
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "memory_allocator/BlockAllocator.h"
+#include "memory_allocator/Chunk.h"
+#include "memory_allocator/MappedSegmentAllocator.h"
+
+static constexpr size_t MB = 1024 * 1024;
+
+// the default alignment, and the size of a Header
+static constexpr size_t ALIGNMENT = alignof(std::max_align_t);
+
+// requests of up to SMALL_LIMIT bytes, Header included, take a segment
+static constexpr size_t SMALL_LIMIT = 256;
+static constexpr size_t CHUNK_SIZE = 16 * MB;
+static constexpr size_t MAX_CHUNKS = 20;
+
+// the arena is reserved, not committed, up front
+static constexpr size_t ARENA_SIZE = 1024 * MB;
+static constexpr size_t MAX_BLOCK_COUNT = 1 << 20;
+static constexpr size_t LARGE_THRESHOLD = MB;
+
+// power-of-two sizes from MIN_CACHED_SIZE to CACHED_LIMIT, Header included
+static constexpr size_t MIN_CACHED_SIZE = 32;
+static constexpr size_t CACHED_LIMIT = 32 * 1024;
+static constexpr size_t SIZE_CLASS_COUNT = 11;
+static constexpr size_t MAX_CACHED_BYTES = 8 * MB;
+
+static constexpr size_t BOOTSTRAP_SIZE = MB;
+
+enum class Source : uint32_t
+{
+    Bootstrap,
+    Segment,
+    Block,
+};
+
+struct alignas(ALIGNMENT) Header
+{
+    // usable bytes after the header
+    size_t size;
+    Source source;
+    // from the start of the block to the user pointer
+    uint32_t offset;
+};
+
+static_assert(sizeof(Header) == ALIGNMENT, "a Header keeps the user pointer aligned");
+
+enum State
+{
+    Uninitialized,
+    Initializing,
+    Ready,
+};
+
+static std::atomic<int> state{Uninitialized};
+
+alignas(ALIGNMENT) static char bootstrap_buffer[BOOTSTRAP_SIZE];
+static std::atomic<size_t> bootstrap_used{0};
+
+static std::mutex segment_mutex, block_mutex;
+
+struct FreeBlock
+{
+    FreeBlock *next;
+};
+
+// freed blocks of one size from one source, taken under its lock
+struct SizeClass
+{
+    FreeBlock *free_blocks;
+    size_t cached_bytes;
+};
+
+static SizeClass segment_classes[SIZE_CLASS_COUNT], block_classes[SIZE_CLASS_COUNT];
+
+// Constructed in place by initialize, and never destroyed, so they outlive every static destructor that frees. Only
+// constant-initialized statics are used, since malloc is called before this library's constructors run.
+alignas(MappedSegmentAllocator) static char segments_storage[sizeof(MappedSegmentAllocator)];
+alignas(BlockAllocator) static char blocks_storage[sizeof(BlockAllocator)];
+
+static MappedSegmentAllocator &get_segments()
+{
+    return *reinterpret_cast<MappedSegmentAllocator *>(segments_storage);
+}
+
+static BlockAllocator &get_blocks()
+{
+    return *reinterpret_cast<BlockAllocator *>(blocks_storage);
+}
+
+static size_t chunk_count = 0;
+
+static void *map(size_t size)
+{
+    void *mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    return mem == MAP_FAILED ? 0 : mem;
+}
+
+static bool add_chunk()
+{
+    if (chunk_count == MAX_CHUNKS)
+    {
+        return false;
+    }
+
+    void *buffer = map(Chunk::get_buffer_size(CHUNK_SIZE));
+
+    if (!buffer || !get_segments().add_chunk(buffer, CHUNK_SIZE))
+    {
+        return false;
+    }
+
+    ++chunk_count;
+
+    return true;
+}
+
+// A fork while another thread holds a lock would leave it held in the child
+static void lock_all()
+{
+    segment_mutex.lock();
+    block_mutex.lock();
+}
+
+static void unlock_all()
+{
+    block_mutex.unlock();
+    segment_mutex.unlock();
+}
+
+static bool initialize()
+{
+    int expected = Uninitialized;
+
+    if (!state.compare_exchange_strong(expected, Initializing))
+    {
+        return expected == Ready;
+    }
+
+    // the constructor allocates its chunk table, from the bootstrap buffer
+    new (segments_storage) MappedSegmentAllocator;
+
+    void *arena = map(BlockAllocator::get_buffer_size(ARENA_SIZE, MAX_BLOCK_COUNT));
+    new (blocks_storage) BlockAllocator;
+
+    if (arena)
+    {
+        get_blocks().init(arena, ARENA_SIZE, MAX_BLOCK_COUNT);
+        get_blocks().set_large_allocation_threshold(LARGE_THRESHOLD);
+    }
+
+    add_chunk();
+
+    pthread_atfork(lock_all, unlock_all, unlock_all);
+
+    state.store(Ready);
+
+    return true;
+}
+
+static size_t get_segment_size(size_t size)
+{
+    size_t segment_size = MIN_CACHED_SIZE;
+
+    while (segment_size < size)
+    {
+        segment_size *= 2;
+    }
+
+    return segment_size;
+}
+
+static SizeClass &get_size_class(SizeClass *classes, size_t size)
+{
+    size_t index = 0;
+
+    while ((MIN_CACHED_SIZE << index) < size)
+    {
+        ++index;
+    }
+
+    return classes[index];
+}
+
+static void *take_cached(SizeClass &size_class, size_t size)
+{
+    FreeBlock *block = size_class.free_blocks;
+
+    if (block)
+    {
+        size_class.free_blocks = block->next;
+        size_class.cached_bytes -= size;
+    }
+
+    return block;
+}
+
+// Returns false, leaving the block to its allocator, when the class already keeps MAX_CACHED_BYTES
+static bool cache(SizeClass &size_class, void *mem, size_t size)
+{
+    if (size_class.cached_bytes + size > MAX_CACHED_BYTES)
+    {
+        return false;
+    }
+
+    FreeBlock *block = static_cast<FreeBlock *>(mem);
+    block->next = size_class.free_blocks;
+    size_class.free_blocks = block;
+    size_class.cached_bytes += size;
+
+    return true;
+}
+
+static void *allocate_bootstrap(size_t size, size_t alignment)
+{
+    size_t offset = (sizeof(Header) + alignment - 1) & ~(alignment - 1);
+    size_t total = (offset + size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+    size_t start = bootstrap_used.fetch_add(total + alignment);
+    if (start + total + alignment > BOOTSTRAP_SIZE)
+    {
+        return 0;
+    }
+
+    // the buffer is ALIGNMENT aligned; pad the block start so the user pointer is aligned
+    uintptr_t base = reinterpret_cast<uintptr_t>(bootstrap_buffer + start);
+    char *mem = reinterpret_cast<char *>(((base + offset + alignment - 1) & ~(alignment - 1)));
+
+    Header *header = reinterpret_cast<Header *>(mem) - 1;
+    header->size = size;
+    header->source = Source::Bootstrap;
+    header->offset = uint32_t(sizeof(Header));
+
+    return mem;
+}
+
+static void *allocate_segment(size_t size)
+{
+    size_t segment_size = get_segment_size(sizeof(Header) + size);
+
+    std::lock_guard<std::mutex> lock(segment_mutex);
+
+    char *block = static_cast<char *>(take_cached(get_size_class(segment_classes, segment_size), segment_size));
+
+    block = block ? block : get_segments().allocate<char>(segment_size);
+
+    if (!block && add_chunk())
+    {
+        block = get_segments().allocate<char>(segment_size);
+    }
+
+    if (!block)
+    {
+        return 0;
+    }
+
+    Header *header = reinterpret_cast<Header *>(block);
+    header->size = segment_size - sizeof(Header);
+    header->source = Source::Segment;
+    header->offset = uint32_t(sizeof(Header));
+
+    return header + 1;
+}
+
+static void *allocate_block(size_t size, size_t alignment)
+{
+    size_t offset = (sizeof(Header) + alignment - 1) & ~(alignment - 1);
+
+    if (size > ~size_t(0) - offset)
+    {
+        return 0;
+    }
+
+    // a block of a cached size is whole, so deallocate can tell its size from the header
+    bool cached = offset + size <= CACHED_LIMIT && alignment == ALIGNMENT;
+    size = cached ? get_segment_size(offset + size) - offset : size;
+
+    char *block = 0;
+    {
+        std::lock_guard<std::mutex> lock(block_mutex);
+
+        if (cached)
+        {
+            block = static_cast<char *>(take_cached(get_size_class(block_classes, offset + size), offset + size));
+        }
+
+        block = block ? block : static_cast<char *>(get_blocks().allocate(offset + size, alignment));
+    }
+
+    if (!block)
+    {
+        return 0;
+    }
+
+    Header *header = reinterpret_cast<Header *>(block + offset) - 1;
+    header->size = size;
+    header->source = Source::Block;
+    header->offset = uint32_t(offset);
+
+    return header + 1;
+}
+
+static void *allocate(size_t size, size_t alignment = ALIGNMENT)
+{
+    size = size ? size : 1;
+    alignment = alignment < ALIGNMENT ? ALIGNMENT : alignment;
+
+    void *mem = 0;
+
+    if (state.load(std::memory_order_acquire) != Ready && !initialize())
+    {
+        mem = allocate_bootstrap(size, alignment);
+    }
+    else if (alignment == ALIGNMENT && size <= SMALL_LIMIT - sizeof(Header))
+    {
+        mem = allocate_segment(size);
+
+        // the chunks are full
+        mem = mem ? mem : allocate_block(size, alignment);
+    }
+    else
+    {
+        mem = allocate_block(size, alignment);
+    }
+
+    if (!mem)
+    {
+        errno = ENOMEM;
+    }
+
+    return mem;
+}
+
+static Header *get_header(void *mem)
+{
+    return static_cast<Header *>(mem) - 1;
+}
+
+static void deallocate(void *mem)
+{
+    if (!mem)
+    {
+        return;
+    }
+
+    Header *header = get_header(mem);
+    char *block = static_cast<char *>(mem) - header->offset;
+
+    switch (header->source)
+    {
+    case Source::Bootstrap:
+        break;
+
+    case Source::Segment:
+    {
+        size_t size = sizeof(Header) + header->size;
+
+        std::lock_guard<std::mutex> lock(segment_mutex);
+
+        if (!cache(get_size_class(segment_classes, size), block, size))
+        {
+            get_segments().deallocate(block, size);
+        }
+        break;
+    }
+
+    case Source::Block:
+    {
+        size_t size = sizeof(Header) + header->size;
+
+        // blocks resized by realloc keep their exact size, which a power of two of a cached size also fits
+        bool cached = header->offset == sizeof(Header) && size <= CACHED_LIMIT && !(size & (size - 1));
+
+        std::lock_guard<std::mutex> lock(block_mutex);
+
+        if (!cached || !cache(get_size_class(block_classes, size), block, size))
+        {
+            get_blocks().deallocate(block);
+        }
+        break;
+    }
+    }
+}
+
+static void *reallocate(void *mem, size_t size)
+{
+    if (!mem)
+    {
+        return allocate(size);
+    }
+
+    Header *header = get_header(mem);
+
+    if (size <= header->size && header->source != Source::Block)
+    {
+        return mem;
+    }
+
+    // a block keeps its offset, so the mapped ones are resized in place or moved by mremap
+    if (header->source == Source::Block && size > SMALL_LIMIT)
+    {
+        char *block = static_cast<char *>(mem) - header->offset;
+        size_t offset = header->offset;
+
+        {
+            std::lock_guard<std::mutex> lock(block_mutex);
+            block = static_cast<char *>(get_blocks().reallocate(block, offset + size));
+        }
+
+        if (!block)
+        {
+            errno = ENOMEM;
+
+            return 0;
+        }
+
+        header = get_header(block + offset);
+        header->size = size;
+
+        return block + offset;
+    }
+
+    void *resized = allocate(size);
+
+    if (resized)
+    {
+        memcpy(resized, mem, header->size < size ? header->size : size);
+        deallocate(mem);
+    }
+
+    return resized;
+}
+
+static bool is_valid_alignment(size_t alignment)
+{
+    return alignment && !(alignment & (alignment - 1));
+}
+
+extern "C"
+{
+    void *malloc(size_t size)
+    {
+        return allocate(size);
+    }
+
+    void free(void *mem)
+    {
+        deallocate(mem);
+    }
+
+    void *calloc(size_t count, size_t size)
+    {
+        if (size && count > ~size_t(0) / size)
+        {
+            errno = ENOMEM;
+
+            return 0;
+        }
+
+        void *mem = allocate(count * size);
+
+        // the bootstrap buffer is already zeroed; freed segments and blocks are kept as they were left
+        if (mem && get_header(mem)->source != Source::Bootstrap)
+        {
+            memset(mem, 0, count * size);
+        }
+
+        return mem;
+    }
+
+    void *realloc(void *mem, size_t size)
+    {
+        if (mem && !size)
+        {
+            deallocate(mem);
+
+            return 0;
+        }
+
+        return reallocate(mem, size);
+    }
+
+    int posix_memalign(void **mem, size_t alignment, size_t size)
+    {
+        if (!is_valid_alignment(alignment) || alignment % sizeof(void *))
+        {
+            return EINVAL;
+        }
+
+        void *allocated = allocate(size, alignment);
+
+        if (!allocated)
+        {
+            return ENOMEM;
+        }
+
+        *mem = allocated;
+
+        return 0;
+    }
+
+    void *aligned_alloc(size_t alignment, size_t size)
+    {
+        if (!is_valid_alignment(alignment))
+        {
+            errno = EINVAL;
+
+            return 0;
+        }
+
+        return allocate(size, alignment);
+    }
+
+    void *memalign(size_t alignment, size_t size)
+    {
+        return aligned_alloc(alignment, size);
+    }
+
+    void *valloc(size_t size)
+    {
+        return allocate(size, sysconf(_SC_PAGESIZE));
+    }
+
+    size_t malloc_usable_size(void *mem)
+    {
+        return mem ? get_header(mem)->size : 0;
+    }
+}
+
+static void *allocate_or_throw(size_t size, size_t alignment = ALIGNMENT)
+{
+    void *mem = allocate(size, alignment);
+
+    if (!mem)
+    {
+        throw std::bad_alloc();
+    }
+
+    return mem;
+}
+
+void *operator new(size_t size)
+{
+    return allocate_or_throw(size);
+}
+
+void *operator new[](size_t size)
+{
+    return allocate_or_throw(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    return allocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    return allocate(size);
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+    return allocate_or_throw(size, size_t(alignment));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+    return allocate_or_throw(size, size_t(alignment));
+}
+
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return allocate(size, size_t(alignment));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    return allocate(size, size_t(alignment));
+}
+
+void operator delete(void *mem) noexcept
+{
+    deallocate(mem);
+}
+
+void operator delete[](void *mem) noexcept
+{
+    deallocate(mem);
+}
+
+void operator delete(void *mem, size_t) noexcept
+{
+    deallocate(mem);
+}
+
+void operator delete[](void *mem, size_t) noexcept
+{
+    deallocate(mem);
+}
+
+void operator delete(void *mem, const std::nothrow_t &) noexcept
+{
+    deallocate(mem);
+}
+
+void operator delete[](void *mem, const std::nothrow_t &) noexcept
+{
+    deallocate(mem);
+}
+
+void operator delete(void *mem, std::align_val_t) noexcept
+{
+    deallocate(mem);
+}
+
+void operator delete[](void *mem, std::align_val_t) noexcept
+{
+    deallocate(mem);
+}
+
+void operator delete(void *mem, size_t, std::align_val_t) noexcept
+{
+    deallocate(mem);
+}
+
+void operator delete[](void *mem, size_t, std::align_val_t) noexcept
+{
+    deallocate(mem);
+}
+
+void operator delete(void *mem, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    deallocate(mem);
+}
+
+void operator delete[](void *mem, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    deallocate(mem);
+}
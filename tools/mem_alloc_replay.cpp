@@ -0,0 +1,362 @@
+// Replays an AllocationTrace against an allocator configuration and reports throughput, peak footprint and
+// fragmentation. The footprint is the memory the allocator has mapped: the arena and its mapped large allocations for
+// a BlockAllocator, and glibc's heap and mmapped chunks (mallinfo2) for malloc. It is sampled after every allocation of
+// a separate, untimed replay, so sampling does not slow the timed ones. A BlockAllocator maps its whole arena up front:
+// lower --arena until allocations fail to find the smallest that fits the trace.
+//
+// usage: mem_alloc_replay <trace> [--allocator block|compact|malloc] [--arena BYTES] [--headers COUNT]
+//                                 [--coalesce immediate|deferred] [--repeat COUNT]
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <malloc.h>
+
+#include "memory_allocator/AllocationTrace.h"
+#include "memory_allocator/BlockAllocator.h"
+
+struct Operation
+{
+    uint32_t slot;
+    uint32_t size;
+    uint32_t alignment;
+    bool allocate;
+};
+
+struct Config
+{
+    std::string allocator = "block";
+    size_t arena_size = 0;
+    size_t header_count = 0;
+    bool deferred = false;
+    size_t repeat = 3;
+};
+
+struct TraceSummary
+{
+    size_t slot_count = 0;
+    size_t peak_live_bytes = 0;
+    size_t peak_live_count = 0;
+    size_t skipped = 0;
+};
+
+// Turns addresses into slot indices, so the replay loop does no hashing. Failed allocations, and frees of blocks
+// allocated before tracing started, are skipped.
+static std::vector<Operation> make_operations(const std::vector<AllocationTrace::Event> &events, TraceSummary &summary)
+{
+    std::vector<Operation> operations;
+    std::unordered_map<uint64_t, uint32_t> live;
+    std::vector<uint32_t> free_slots, slot_sizes;
+
+    size_t live_bytes = 0;
+
+    for (const AllocationTrace::Event &event : events)
+    {
+        if (event.operation == AllocationTrace::Operation::Allocate)
+        {
+            if (!event.address)
+            {
+                ++summary.skipped;
+                continue;
+            }
+
+            uint32_t slot;
+            if (free_slots.size())
+            {
+                slot = free_slots.back();
+                free_slots.pop_back();
+            }
+            else
+            {
+                slot = slot_sizes.size();
+                slot_sizes.push_back(0);
+            }
+
+            live[event.address] = slot;
+            slot_sizes[slot] = event.size;
+
+            live_bytes += event.size;
+            summary.peak_live_bytes = live_bytes > summary.peak_live_bytes ? live_bytes : summary.peak_live_bytes;
+            summary.peak_live_count = live.size() > summary.peak_live_count ? live.size() : summary.peak_live_count;
+
+            operations.push_back({slot, event.size, uint32_t(1) << event.alignment_log2, true});
+        }
+        else
+        {
+            auto it = live.find(event.address);
+
+            if (it == live.end())
+            {
+                ++summary.skipped;
+                continue;
+            }
+
+            uint32_t slot = it->second;
+            live.erase(it);
+            free_slots.push_back(slot);
+
+            live_bytes -= slot_sizes[slot];
+
+            operations.push_back({slot, slot_sizes[slot], 0, false});
+        }
+    }
+
+    summary.slot_count = slot_sizes.size();
+
+    return operations;
+}
+
+struct Result
+{
+    double seconds = 0;
+    size_t failed = 0;
+    size_t peak_footprint = 0;
+};
+
+struct Malloc
+{
+    // what the tool itself has mapped is not counted
+    Malloc(const Config &)
+    {
+        malloc_trim(0);
+        baseline = get_heap_bytes();
+    }
+
+    size_t get_mapped_bytes() const
+    {
+        size_t heap_bytes = get_heap_bytes();
+
+        return heap_bytes > baseline ? heap_bytes - baseline : 0;
+    }
+
+    static size_t get_heap_bytes()
+    {
+        struct mallinfo2 info = mallinfo2();
+
+        return info.arena + info.hblkhd;
+    }
+
+    void *allocate(size_t size, size_t alignment)
+    {
+        return alignment > alignof(std::max_align_t) ? aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1))
+                                                     : malloc(size);
+    }
+
+    void deallocate(void *mem)
+    {
+        free(mem);
+    }
+
+    size_t baseline = 0;
+};
+
+template <typename BlockAllocatorType> struct Block
+{
+    Block(const Config &config) : allocator(config.arena_size, config.header_count)
+    {
+        if (config.deferred)
+        {
+            allocator.set_coalesce_policy(BlockAllocatorType::CoalescePolicy::Deferred);
+        }
+    }
+
+    void *allocate(size_t size, size_t alignment)
+    {
+        return allocator.allocate(size, alignment);
+    }
+
+    void deallocate(void *mem)
+    {
+        allocator.deallocate(mem);
+    }
+
+    size_t get_mapped_bytes() const
+    {
+        AllocatorStats stats = allocator.get_stats();
+
+        return stats.capacity + stats.mapped_bytes;
+    }
+
+    BlockAllocatorType allocator;
+};
+
+// One pass over the operations; with measure, samples the resource's mapped bytes after every allocation
+template <typename Resource>
+static Result replay_once(const Config &config, const std::vector<Operation> &operations, size_t slot_count,
+                          bool measure)
+{
+    Resource resource(config);
+    std::vector<void *> slots(slot_count);
+
+    Result result;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (const Operation &operation : operations)
+    {
+        if (operation.allocate)
+        {
+            void *mem = resource.allocate(operation.size, operation.alignment);
+            slots[operation.slot] = mem;
+
+            result.failed += !mem;
+
+            if (measure)
+            {
+                size_t mapped_bytes = resource.get_mapped_bytes();
+                result.peak_footprint = mapped_bytes > result.peak_footprint ? mapped_bytes : result.peak_footprint;
+            }
+        }
+        else if (slots[operation.slot])
+        {
+            resource.deallocate(slots[operation.slot]);
+            slots[operation.slot] = 0;
+        }
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (void *mem : slots)
+    {
+        if (mem)
+        {
+            resource.deallocate(mem);
+        }
+    }
+
+    return result;
+}
+
+template <typename Resource>
+static Result replay(const Config &config, const std::vector<Operation> &operations, size_t slot_count)
+{
+    // first, while malloc's heap holds none of the timed runs' memory
+    size_t peak_footprint = replay_once<Resource>(config, operations, slot_count, true).peak_footprint;
+
+    Result best;
+
+    for (size_t run = 0; run < config.repeat; ++run)
+    {
+        Result result = replay_once<Resource>(config, operations, slot_count, false);
+
+        if (!run || result.seconds < best.seconds)
+        {
+            best = result;
+        }
+    }
+
+    best.peak_footprint = peak_footprint;
+
+    return best;
+}
+
+static bool parse_arguments(int argc, char **argv, Config &config)
+{
+    for (int i = 2; i < argc; ++i)
+    {
+        bool has_value = i + 1 < argc;
+
+        if (!strcmp(argv[i], "--allocator") && has_value)
+        {
+            config.allocator = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--arena") && has_value)
+        {
+            config.arena_size = strtoull(argv[++i], 0, 10);
+        }
+        else if (!strcmp(argv[i], "--headers") && has_value)
+        {
+            config.header_count = strtoull(argv[++i], 0, 10);
+        }
+        else if (!strcmp(argv[i], "--coalesce") && has_value)
+        {
+            config.deferred = !strcmp(argv[++i], "deferred");
+        }
+        else if (!strcmp(argv[i], "--repeat") && has_value)
+        {
+            config.repeat = strtoull(argv[++i], 0, 10);
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return config.repeat && (config.allocator == "block" || config.allocator == "compact" || config.allocator == "malloc");
+}
+
+int main(int argc, char **argv)
+{
+    Config config;
+
+    if (argc < 2 || !parse_arguments(argc, argv, config))
+    {
+        fprintf(stderr, "usage: %s <trace> [--allocator block|compact|malloc] [--arena BYTES] [--headers COUNT]\n"
+                        "       [--coalesce immediate|deferred] [--repeat COUNT]\n",
+                argv[0]);
+        return 2;
+    }
+
+    std::vector<AllocationTrace::Event> events;
+
+    if (!AllocationTrace::read(argv[1], events))
+    {
+        fprintf(stderr, "%s: cannot read trace %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    TraceSummary summary;
+    std::vector<Operation> operations = make_operations(events, summary);
+
+    // by default, twice the trace's peak live set, with room for a hole between every pair of live blocks
+    if (!config.arena_size)
+    {
+        config.arena_size = summary.peak_live_bytes * 2 + 4096;
+    }
+
+    if (!config.header_count)
+    {
+        config.header_count = summary.peak_live_count * 2 + 1;
+    }
+
+    Result result;
+
+    if (config.allocator == "block")
+    {
+        result = replay<Block<BlockAllocator>>(config, operations, summary.slot_count);
+    }
+    else if (config.allocator == "compact")
+    {
+        result = replay<Block<CompactBlockAllocator>>(config, operations, summary.slot_count);
+    }
+    else
+    {
+        result = replay<Malloc>(config, operations, summary.slot_count);
+    }
+
+    double fragmentation = result.peak_footprint ? 1 - summary.peak_live_bytes / double(result.peak_footprint) : 0;
+
+    printf("trace:              %s (%zu events, %zu skipped)\n", argv[1], events.size(), summary.skipped);
+    if (config.allocator == "malloc")
+    {
+        printf("allocator:          malloc\n");
+    }
+    else
+    {
+        printf("allocator:          %s, arena %zu bytes, %zu headers, %s coalescing\n", config.allocator.c_str(),
+               config.arena_size, config.header_count, config.deferred ? "deferred" : "immediate");
+    }
+    printf("operations:         %zu (%zu failed allocations)\n", operations.size(), result.failed);
+    printf("throughput:         %.0f ops/s\n", operations.size() / result.seconds);
+    printf("peak live bytes:    %zu\n", summary.peak_live_bytes);
+    printf("peak footprint:     %zu bytes mapped\n", result.peak_footprint);
+    printf("fragmentation:      %.3f\n", fragmentation);
+
+    return 0;
+}